@@ -8,33 +8,90 @@
 #include <pcl/point_types.h>
 
 #include "trajectory.h"
+#include "trajectory_batch.h"
 #include "kd_tree.h"
+#include "worker_pool.h"
 
 #include <chrono>
+#include <cstdint>
+#include <vector>
 
 class DepthImageCollisionEvaluator {
 public:
 	DepthImageCollisionEvaluator() {
-		K << 142.58555603027344, 0.0, 79.5, 0.0, 142.58555603027344, 59.5, 0.0, 0.0, 1.0;
-		std::cout << "K is " << K << std::endl;
+		Matrix3 default_K;
+		default_K << 142.58555603027344, 0.0, 79.5, 0.0, 142.58555603027344, 59.5, 0.0, 0.0, 1.0;
+		setCameraModel(default_K, 160, 120, 0);
 		std::cout << "sigma_depth_point is " << sigma_depth_point << std::endl;
 
 	}
+
+  // Intrinsics and size of the sensor's organized cloud, as in sensor_msgs/CameraInfo. Clouds are evaluated
+  // at pyramid_level, each level halving the resolution by keeping the nearest return of every 2x2 block.
+  void setCameraModel(Matrix3 const& sensor_K, size_t const& sensor_width, size_t const& sensor_height, size_t const& pyramid_level);
+  size_t getImageWidth() const {
+    return image_width;
+  };
+  size_t getImageHeight() const {
+    return image_height;
+  };
 	
   void UpdatePointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new);
+  // Raw depth image input in place of the organized cloud (e.g. 16UC1 in mm with depth_scale 0.001, or 32FC1 in m),
+  // rows row_step bytes apart. Points come from the camera model; the KDTree variants still need a cloud.
+  void UpdateDepthImage(uint16_t const* depth, size_t const& width, size_t const& height, size_t const& row_step, Scalar const& depth_scale);
+  void UpdateDepthImage(float const* depth, size_t const& width, size_t const& height, size_t const& row_step, Scalar const& depth_scale);
   void BuildKDTree();
+  // Rebuild the kd-tree on every UpdatePointCloudPtr, for the KDTree query variants
+  void setKDTreeEnabled(bool const& enabled) {
+    kd_tree_enabled = enabled;
+  };
 
   // One-position-only variants
-  double computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
+  Scalar computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
   bool computeDeterministicCollisionOnePositionKDTree(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
-  double computeProbabilityOfCollisionOnePositionKDTree(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
+  Scalar computeProbabilityOfCollisionOnePositionKDTree(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
 
 
   // Multiple-position variants
-  double computeProbabilityOfCollisionOnePositionBlock(Vector3 const& robot_position, Vector3 const& sigma_robot_position, size_t const& block_increment);
-  double computeProbabilityOfCollisionOnePositionBlockMarching(Vector3 const& robot_position, Vector3 const& sigma_robot_position, size_t const& block_increment);
+  Scalar computeProbabilityOfCollisionOnePositionBlock(Vector3 const& robot_position, Vector3 const& sigma_robot_position, size_t const& block_increment);
+  Scalar computeProbabilityOfCollisionOnePositionBlockVectorized(Vector3 const& robot_position, Vector3 const& sigma_robot_position, size_t const& block_increment);
+  Scalar computeLogProbabilityOfNoCollisionOnePositionBlock(Vector3 const& robot_position, Vector3 const& sigma_robot_position, size_t const& block_increment, Scalar const& log_no_collision_floor);
+  Scalar computeProbabilityOfCollisionOnePositionBlockMarching(Vector3 const& robot_position, Vector3 const& sigma_robot_position, size_t const& block_increment);
   
   bool computeDeterministicCollisionOnePositionBlock(Vector3 const& robot_position, Vector3 const& sigma_robot_position, size_t const& block_increment);
+
+  // With the adaptive window on, the block kernels size each window to robot_radius plus num_sigmas standard
+  // deviations of the combined uncertainty, as projected at the query's depth, within [1, max_block_increment]
+  // pixels; the block_increment they are given then only applies with the adaptive window off
+  void setAdaptiveWindow(bool const& enabled, Scalar const& num_sigmas, Scalar const& robot_radius, size_t const& max_block_increment) {
+    adaptive_window = enabled;
+    adaptive_window_sigmas = num_sigmas;
+    adaptive_window_robot_radius = robot_radius;
+    adaptive_window_max_block = max_block_increment;
+  };
+
+  // C-space backend: per frame, the min-depth image dilated by robot_radius as projected at each slice depth (ascending).
+  // A query reads one pixel of the slice for its depth and treats space at or behind the nearest return in the
+  // robot's footprint as occupied; queries shallower than the first slice read the nearest return in the image.
+  // An empty slice_depths turns it off.
+  void setInflationSlices(Scalar const& robot_radius, std::vector<Scalar> const& slice_depths);
+  bool computeDeterministicCollisionOnePositionInflated(Vector3 const& robot_position);
+  Scalar computeProbabilityOfCollisionOnePositionInflated(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
+  void EvaluateBatchInflated(TrajectorySamples const& samples, Vector3 const& sigma_robot_position, size_t const& trajectory_stride, Eigen::Ref<VectorX> probabilities);
+
+  // With log domain on, EvaluateBatch sums log(1 - p) over each trajectory's windows in time order, as
+  // computeLogProbabilityOfNoCollisionOnePositionBlock does per sample, and stops a trajectory once its collision
+  // probability reaches saturation; saturated trajectories report at least saturation.
+  void setLogDomain(bool const& enabled, Scalar const& saturation) {
+    log_domain = enabled;
+    log_domain_floor = std::log1p(-saturation);
+  };
+
+  // Block collision probability of every trajectory_stride'th row of samples over all of its sample times, matching
+  // computeProbabilityOfCollisionOnePositionBlockVectorized per sample. Samples are evaluated in pixel-tile order,
+  // split across worker_pool if given; other rows of probabilities are left untouched.
+  void EvaluateBatch(TrajectorySamples const& samples, Vector3 const& sigma_robot_position, size_t const& block_increment, size_t const& trajectory_stride, Eigen::Ref<VectorX> probabilities, WorkerPool* worker_pool = nullptr);
   //double computeProbabilityOfCollisionKDTree(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
 
 
@@ -44,18 +101,97 @@ public:
   
 
 private:
+  void UpdateDepthPlanes();
+  template <typename DepthType>
+  void UpdateDepthPlanesFromImage(DepthType const* depth, size_t const& width, size_t const& height, size_t const& row_step, Scalar const& depth_scale);
+  void ResizeDepthPlanes();
+
+  bool IsValidReturn(int i, int j) const {
+    return (valid_returns[j*mask_words_per_row + i/64] >> (i % 64)) & 1;
+  };
+  bool RowHasValidReturns(int j, int i_begin, int i_end) const;
+
+  int computeBlockIncrement(Scalar const& depth, Vector3 const& total_sigma, size_t const& block_increment) const;
+  void UpdateDepthPyramid();
+  void UpdateInflatedSlices();
+  void MinFilterLine(Scalar* line, int length, int stride, int radius);
+  Scalar getInflatedDepth(Vector3 const& robot_position, bool &in_image);
+  bool IsWindowOutOfRange(int i_begin, int i_end, int j_begin, int j_end, Scalar const& depth, Scalar const& depth_bound) const;
+  Scalar computeNegligibleDepthBound(Scalar const& coefficient, Scalar const& total_sigma_depth, int num_pixels) const;
+  Scalar computeNoCollisionProbabilityInWindow(Vector3 const& robot_position, int pi_x, int pi_y, int block, Vector3 const& inverse_total_sigma, Scalar const& total_sigma_depth, Scalar const& coefficient) const;
+  Scalar computeLogNoCollisionProbabilityInWindow(Vector3 const& robot_position, int pi_x, int pi_y, int block, Vector3 const& inverse_total_sigma, Scalar const& total_sigma_depth, Scalar const& coefficient, Scalar const& log_no_collision_floor) const;
+  // Window rows are evaluated in segments of at most window_segment_size pixels, in a fixed-capacity array on the
+  // stack, so no query allocates
+  static const int window_segment_size = 64;
+  typedef Eigen::Array<Scalar, Eigen::Dynamic, 1, 0, window_segment_size, 1> WindowSegment;
+  Vector3 getDepthPosition(int i, int j) const {
+    return Vector3(depth_x(j, i), depth_y(j, i), depth_z(j, i));
+  };
+
   pcl::PointCloud<pcl::PointXYZ>::Ptr xyz_cloud_ptr;
+  // Set once the planes hold a frame, from either a cloud or a depth image
+  bool has_depth_frame = false;
+
+  // Row-major planes of the latest organized cloud, and one valid-return bit per pixel
+  typedef Eigen::Array<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> DepthPlane;
+  DepthPlane depth_x;
+  DepthPlane depth_y;
+  DepthPlane depth_z;
+  std::vector<uint64_t> valid_returns;
+  size_t mask_words_per_row = 0;
+
+  // Level l holds the min and max depth of valid returns over 2^l x 2^l blocks of the planes
+  std::vector<DepthPlane> min_depth_pyramid;
+  std::vector<DepthPlane> max_depth_pyramid;
+
+  bool log_domain = false;
+  Scalar log_domain_floor = std::log1p(-0.99);
+
+  bool adaptive_window = false;
+  Scalar adaptive_window_sigmas = 3.0;
+  Scalar adaptive_window_robot_radius = 0.4;
+  size_t adaptive_window_max_block = 40;
+
+  // Inflated min-depth image per slice depth, no returns being +inf
+  Scalar inflation_radius = 0.4;
+  std::vector<Scalar> inflation_slice_depths;
+  std::vector<DepthPlane> inflated_min_depth;
+  // Nearest return in the whole image, for queries shallower than the first slice
+  Scalar inflated_min_depth_near = 0;
+  std::vector<Scalar> min_filter_line;
+  std::vector<int> min_filter_window;
+
+  // Total collision probability a window may drop when it is skipped on depth alone
+  Scalar negligible_probability = 1.0e-6;
 
   Vector3 sigma_depth_point = Vector3(0.1, 0.1, 0.1);
 
-  Eigen::Matrix<double, 3, 3> K;
-
-  double probability_of_collision_in_unknown = 0.0;  // 0.05 is reasonable
+  // K is scaled to the evaluated pyramid level
+  Matrix3 K;
+  Matrix3 sensor_K;
+  size_t sensor_width;
+  size_t sensor_height;
+  size_t pyramid_level;
+  int image_width;
+  int image_height;
+
+  Scalar probability_of_collision_in_unknown = 0.0;  // 0.05 is reasonable
+
+  // For EvaluateBatch, reused across ticks
+  static const int batch_tile_size = 16;
+  static const size_t batch_chunk_size = 32;
+  ArrayXX batch_projected[3];
+  Eigen::ArrayXXi batch_pixel_x;
+  Eigen::ArrayXXi batch_pixel_y;
+  ArrayXX batch_collision;
+  std::vector<size_t> batch_tile_offsets;
+  std::vector<size_t> batch_tile_queries;
 
   // For kd-tree version
-  KDTree<double> my_kd_tree;
-  std::vector<pcl::PointXYZ> closest_pts;
-  std::vector<double> squared_distances;
+  KDTree<Scalar> my_kd_tree;
+  bool kd_tree_enabled = false;
+  std::array<pcl::PointXYZ, 1> closest_pts;
+  std::array<Scalar, 1> squared_distances;
 
 
 };
\ No newline at end of file
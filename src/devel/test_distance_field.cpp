@@ -0,0 +1,76 @@
+// Checks the distance field's EDT against a brute-force nearest-occupied-voxel search, and that it never
+// reports more than the true distance to a return.
+// Returns non-zero if any check fails.
+
+#include "distance_field_collision_evaluator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+
+bool Check(char const* name, double value, double tolerance) {
+  std::printf("%-36s %.3g (tolerance %.3g) %s\n", name, value, tolerance, value <= tolerance ? "ok" : "FAILED");
+  return value <= tolerance;
+}
+
+// Each voxel's distance is the exact voxel-centre distance to the nearest occupied voxel, less one voxel diagonal
+bool CheckDistanceField() {
+  Vector3 min_corner(-1.0, -1.0, 0.0);
+  Scalar resolution = 0.1;
+  DistanceFieldCollisionEvaluator distance_field;
+  distance_field.setBounds(min_corner, Vector3(1.0, 1.0, 2.0), resolution);
+
+  std::mt19937 generator(2);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
+  std::vector<Eigen::Vector3i> occupied;
+  for (int n = 0; n < 40; n++) {
+    pcl::PointXYZ point(-0.95 + 1.9*uniform(generator), -0.95 + 1.9*uniform(generator), 0.05 + 1.9*uniform(generator));
+    cloud->points.push_back(point);
+    Vector3 voxel = (Vector3(point.x, point.y, point.z) - min_corner) / resolution;
+    occupied.push_back(Eigen::Vector3i(voxel(0), voxel(1), voxel(2)));
+  }
+  cloud->points.push_back(pcl::PointXYZ(std::numeric_limits<float>::quiet_NaN(), 0, 0));
+  cloud->width = cloud->points.size();
+  cloud->height = 1;
+  distance_field.UpdatePointCloudPtr(cloud);
+
+  double edt_error = 0;
+  double bound_violation = 0;
+  double diagonal = std::sqrt(3.0)*resolution;
+  for (int k = 0; k < 20; k++) {
+    for (int j = 0; j < 20; j++) {
+      for (int i = 0; i < 20; i++) {
+        int nearest_squared = std::numeric_limits<int>::max();
+        for (size_t n = 0; n < occupied.size(); n++) {
+          nearest_squared = std::min(nearest_squared, (occupied[n] - Eigen::Vector3i(i, j, k)).squaredNorm());
+        }
+        double reference = std::max(0.0, std::sqrt(double(nearest_squared))*resolution - diagonal);
+        Vector3 centre = min_corner + resolution*Vector3(i + 0.5, j + 0.5, k + 0.5);
+        double distance = double(distance_field.getDistance(centre));
+        edt_error = std::max(edt_error, std::abs(distance - reference));
+
+        double nearest_return = std::numeric_limits<double>::infinity();
+        for (size_t n = 0; n + 1 < cloud->points.size(); n++) {
+          pcl::PointXYZ const& point = cloud->points[n];
+          nearest_return = std::min(nearest_return, double((centre - Vector3(point.x, point.y, point.z)).norm()));
+        }
+        bound_violation = std::max(bound_violation, distance - nearest_return);
+      }
+    }
+  }
+  bool passed = Check("distance field EDT (m)", edt_error, 1.0e-5);
+  passed &= Check("distance field over true distance (m)", bound_violation, 1.0e-5);
+  return passed;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  return CheckDistanceField() ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+// Checks the preprocessor's RANSAC ground removal on a ray-cast floor and box: the floor plane is found and
+// exactly the floor returns are removed.
+// Returns non-zero if any check fails.
+
+#include "point_cloud_preprocessor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+namespace {
+
+const double kFocalLength = 142.58555603027344;
+
+bool Check(char const* name, double value, double tolerance) {
+  std::printf("%-36s %.3g (tolerance %.3g) %s\n", name, value, tolerance, value <= tolerance ? "ok" : "FAILED");
+  return value <= tolerance;
+}
+
+// 160x120 organized cloud: a floor 1 m below the sensor (+y in RDF) and a box 3 m ahead standing clear of it
+bool CheckGroundRemoval() {
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
+  cloud->width = 160;
+  cloud->height = 120;
+  cloud->points.resize(160*120);
+  std::vector<bool> is_box(160*120, false);
+  float nan = std::numeric_limits<float>::quiet_NaN();
+  for (int j = 0; j < 120; j++) {
+    for (int i = 0; i < 160; i++) {
+      Vector3 ray((i - 79.5)/kFocalLength, (j - 59.5)/kFocalLength, 1.0);
+      pcl::PointXYZ& point = cloud->points[j*160 + i];
+      point = pcl::PointXYZ(nan, nan, nan);
+      Vector3 box_hit = 3.0*ray;
+      if (std::abs(box_hit(0)) < 0.5 && box_hit(1) > -0.5 && box_hit(1) < 0.8) {
+        point = pcl::PointXYZ(box_hit(0), box_hit(1), box_hit(2));
+        is_box[j*160 + i] = true;
+      }
+      else if (ray(1) > 0 && 1.0/ray(1) < 12.0) {
+        Vector3 floor_hit = ray/ray(1);
+        point = pcl::PointXYZ(floor_hit(0), floor_hit(1), floor_hit(2));
+      }
+    }
+  }
+
+  PointCloudPreprocessor preprocessor;
+  preprocessor.setGroundRemoval(true, 0.1, 0.35);
+  preprocessor.Process(cloud);
+
+  size_t floor_kept = 0;
+  size_t box_removed = 0;
+  for (size_t n = 0; n < cloud->points.size(); n++) {
+    bool kept = cloud->points[n].z == cloud->points[n].z;
+    floor_kept += !is_box[n] && kept;
+    box_removed += is_box[n] && !kept;
+  }
+  Vector3 normal;
+  Scalar offset;
+  bool found = preprocessor.getGroundPlane(normal, offset);
+  double plane_error = found ? std::max(double((normal - Vector3(0, -1, 0)).norm()), std::abs(offset - 1.0)) : 1.0;
+
+  bool passed = Check("ground plane normal and offset", plane_error, 1.0e-3);
+  passed &= Check("floor returns kept", floor_kept, 0);
+  passed &= Check("box returns removed", box_removed, 0);
+  return passed;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  return CheckGroundRemoval() ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+// Checks the kd-tree radius search against a brute-force scan of the cloud, with no-returns in it.
+// Returns non-zero if any check fails.
+
+#include "trajectory.h"
+#include "kd_tree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+
+bool Check(char const* name, double value, double tolerance) {
+  std::printf("%-36s %.3g (tolerance %.3g) %s\n", name, value, tolerance, value <= tolerance ? "ok" : "FAILED");
+  return value <= tolerance;
+}
+
+// The radius search returns exactly the returns a brute-force scan finds within the radius, no-returns excluded
+bool CheckRadiusSearch() {
+  std::mt19937 generator(3);
+  std::uniform_real_distribution<float> uniform(-1.0, 1.0);
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
+  for (int n = 0; n < 5000; n++) {
+    if (n % 7 == 0) {
+      float nan = std::numeric_limits<float>::quiet_NaN();
+      cloud->points.push_back(pcl::PointXYZ(nan, nan, nan));
+      continue;
+    }
+    cloud->points.push_back(pcl::PointXYZ(2.0*uniform(generator), uniform(generator), 3.0 + uniform(generator)));
+  }
+  cloud->width = cloud->points.size();
+  cloud->height = 1;
+  KDTree<Scalar> kd_tree;
+  kd_tree.Initialize(cloud);
+
+  std::vector<std::pair<size_t, Scalar> > neighbours;
+  size_t mismatches = 0;
+  for (int q = 0; q < 200; q++) {
+    Vector3 query(2.0*uniform(generator), uniform(generator), 3.0 + uniform(generator));
+    Scalar radius = 0.1 + 0.2*(q % 3);
+    kd_tree.SearchWithinRadius(query(0), query(1), query(2), radius, neighbours);
+
+    std::vector<pcl::PointXYZ const*> found;
+    for (size_t n = 0; n < neighbours.size(); n++) {
+      found.push_back(&kd_tree.getPoint(neighbours[n].first));
+    }
+    std::vector<pcl::PointXYZ const*> expected;
+    for (size_t n = 0; n < cloud->points.size(); n++) {
+      pcl::PointXYZ const& point = cloud->points[n];
+      if (point.x == point.x && (query - Vector3(point.x, point.y, point.z)).squaredNorm() < radius*radius) {
+        expected.push_back(&point);
+      }
+    }
+    std::sort(found.begin(), found.end());
+    std::sort(expected.begin(), expected.end());
+    mismatches += (found != expected);
+  }
+  return Check("radius searches mismatched", mismatches, 0);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  return CheckRadiusSearch() ? 0 : 1;
+}
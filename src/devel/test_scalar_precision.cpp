@@ -0,0 +1,185 @@
+// Checks the numeric kernels against double-precision references written out here, and the Euclidean selection
+// against the double build's choices.
+// Built twice by CMakeLists.txt, as test_scalar_precision and test_scalar_precision_float
+// (-DTRAJECTORY_SELECTOR_USE_FLOAT), so the float pipeline is held to the same references as the double one.
+// Returns non-zero if any difference exceeds its tolerance.
+
+#include "trajectory_selector.h"
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+typedef Eigen::Vector3d Vector3d;
+
+namespace {
+
+const double kJerkTime = 0.2;
+const double kAccelerationMax = 9.8*0.50;
+
+// Best primitives of the double build for the selection cases in main(), initial speed major, carrot heading minor
+const size_t kReferenceSelections[3][8] = {{9, 2, 3, 4, 5, 6, 7, 8}, {10, 10, 3, 4, 5, 6, 7, 16}, {18, 11, 4, 4, 5, 6, 6, 15}};
+
+// Trajectory::getPosition / getVelocity with a zero initial acceleration
+Vector3d ReferencePosition(Vector3d const& acceleration, Vector3d const& initial_velocity, double t) {
+  if (t < kJerkTime) {
+    Vector3d jerk = acceleration / kJerkTime;
+    return 0.1666*jerk*t*t*t + initial_velocity*t;
+  }
+  double t_left = t - kJerkTime;
+  return 0.1666*acceleration*kJerkTime*kJerkTime + initial_velocity*kJerkTime + 0.5*acceleration*t_left*t_left + initial_velocity*t_left;
+}
+
+Vector3d ReferenceVelocity(Vector3d const& acceleration, Vector3d const& initial_velocity, double t) {
+  if (t < kJerkTime) {
+    return 0.5*acceleration/kJerkTime*t*t + initial_velocity;
+  }
+  return 0.5*acceleration*kJerkTime + initial_velocity + acceleration*(t - kJerkTime);
+}
+
+// Trajectory::getTerminalStopPosition
+Vector3d ReferenceTerminalStopPosition(Vector3d const& acceleration, Vector3d const& initial_velocity, double t) {
+  Vector3d position = ReferencePosition(acceleration, initial_velocity, t);
+  Vector3d velocity = ReferenceVelocity(acceleration, initial_velocity, t);
+  Vector3d stopping_vector = -velocity/velocity.norm();
+  Vector3d stopping_jerk = (kAccelerationMax*stopping_vector - acceleration) / kJerkTime;
+  Vector3d position_end_of_jerk_stop = 0.1666*stopping_jerk*kJerkTime*kJerkTime*kJerkTime + 0.5*acceleration*kJerkTime*kJerkTime + velocity*kJerkTime + position;
+  Vector3d velocity_end_of_jerk_stop = 0.5*stopping_jerk*kJerkTime*kJerkTime + acceleration*kJerkTime + velocity;
+  if (velocity.dot(velocity_end_of_jerk_stop) < 0) {
+    return position_end_of_jerk_stop;
+  }
+  double realistic_stop_accel = kAccelerationMax*0.65;
+  double speed_after_jerk = velocity_end_of_jerk_stop.norm();
+  double stop_t_after_jerk = speed_after_jerk / realistic_stop_accel;
+  double stopping_distance_after_jerk = 0.5 * -realistic_stop_accel * stop_t_after_jerk*stop_t_after_jerk + speed_after_jerk*stop_t_after_jerk;
+  return position_end_of_jerk_stop + stopping_distance_after_jerk*-stopping_vector;
+}
+
+// 160x120 organized cloud: a slanted wall on the right half, a patch at 2 m in the bottom left, no returns elsewhere
+pcl::PointCloud<pcl::PointXYZ>::Ptr MakeScene(double f) {
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
+  cloud->width = 160;
+  cloud->height = 120;
+  cloud->points.resize(160*120);
+  for (int j = 0; j < 120; j++) {
+    for (int i = 0; i < 160; i++) {
+      pcl::PointXYZ& point = cloud->points[j*160 + i];
+      double z = (i > 70) ? 3.0 + 0.01*(i - 70) : (j > 90 ? 2.0 : -1.0);
+      if (z < 0) {
+        point.x = point.y = point.z = std::numeric_limits<float>::quiet_NaN();
+        continue;
+      }
+      point.x = (i - 79.5)*z/f;
+      point.y = (j - 59.5)*z/f;
+      point.z = z;
+    }
+  }
+  return cloud;
+}
+
+// DepthImageCollisionEvaluator::computeProbabilityOfCollisionOnePositionBlockVectorized without the early skip
+double ReferenceBlockProbability(pcl::PointCloud<pcl::PointXYZ> const& cloud, double f, Vector3d const& position, int pi_x, int pi_y, int block, double sigma) {
+  double total_sigma = sigma + 0.1;
+  double coefficient = 0.267 / std::sqrt(248.05021344239853*total_sigma*total_sigma*total_sigma);
+  double probability_no_collision = 1;
+  for (int j = std::max(pi_y - block, 0); j <= std::min(pi_y + block, 119); j++) {
+    for (int i = std::max(pi_x - block, 0); i <= std::min(pi_x + block, 159); i++) {
+      pcl::PointXYZ const& point = cloud.points[j*160 + i];
+      if (!(point.z == point.z)) {
+        continue;
+      }
+      Vector3d d = position - Vector3d(point.x, point.y, point.z);
+      probability_no_collision *= 1 - coefficient*std::exp(-0.5*d.squaredNorm()/total_sigma);
+    }
+  }
+  return 1 - probability_no_collision;
+}
+
+bool Check(char const* name, double max_error, double tolerance) {
+  std::printf("%-28s max error %.3g (tolerance %.3g) %s\n", name, max_error, tolerance, max_error <= tolerance ? "ok" : "FAILED");
+  return max_error <= tolerance;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  std::printf("Scalar is %s\n", sizeof(Scalar) == sizeof(float) ? "float" : "double");
+  bool passed = true;
+
+  // Library sampling and terminal stop positions, at a non-zero initial velocity (planar, as the 2D library keeps it)
+  TrajectoryLibrary library;
+  library.Initialize2DLibrary(1.0);
+  Vector3d initial_velocity(1.5, -0.5, 0.0);
+  library.setInitialVelocity(initial_velocity.cast<Scalar>());
+
+  VectorX sampling_time_vector = VectorX::LinSpaced(20, 0.05, 1.0);
+  TrajectorySamples positions;
+  library.getBatch().Sample(sampling_time_vector, &positions, nullptr);
+  ArrayX3 terminal_stop_positions;
+  library.getBatch().SampleTerminalStopPositions(1.0, terminal_stop_positions);
+
+  double position_error = 0;
+  double stop_error = 0;
+  for (size_t i = 0; i < library.getNumTrajectories(); i++) {
+    Vector3d acceleration = library.getBatch().getAcceleration(i).cast<double>();
+    for (int t = 0; t < sampling_time_vector.size(); t++) {
+      Vector3d reference = ReferencePosition(acceleration, initial_velocity, sampling_time_vector(t));
+      position_error = std::max(position_error, (positions.getSample(i, t).cast<double>() - reference).norm());
+    }
+    Vector3d reference = ReferenceTerminalStopPosition(acceleration, initial_velocity, 1.0);
+    stop_error = std::max(stop_error, (terminal_stop_positions.row(i).transpose().cast<double>().matrix() - reference).norm());
+  }
+  passed &= Check("sampled positions (m)", position_error, 1.0e-4);
+  passed &= Check("terminal stop positions (m)", stop_error, 1.0e-3);
+
+  // Depth image block kernel
+  double f = 142.58555603027344;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud = MakeScene(f);
+  DepthImageCollisionEvaluator depth_image_collision_evaluator;
+  depth_image_collision_evaluator.UpdatePointCloudPtr(cloud);
+
+  double probability_error = 0;
+  size_t num_compared = 0;
+  for (int n = 0; n < 2000; n++) {
+    Vector3d position(-2.0 + 4.0*((n*37) % 101)/100.0, -1.5 + 3.0*((n*53) % 97)/96.0, 0.5 + 5.0*((n*71) % 89)/88.0);
+    // Queries that project within rounding of a pixel edge may land in a neighbouring window in float
+    double u = f*position(0)/position(2) + 79.5;
+    double v = f*position(1)/position(2) + 59.5;
+    if (u < 0 || u >= 160 || v < 0 || v >= 120 || std::abs(u - std::round(u)) < 1.0e-3 || std::abs(v - std::round(v)) < 1.0e-3) {
+      continue;
+    }
+    double probability = depth_image_collision_evaluator.computeProbabilityOfCollisionOnePositionBlockVectorized(position.cast<Scalar>(), Vector3(0.01, 0.01, 0.01), 10);
+    double reference = ReferenceBlockProbability(*cloud, f, position, int(u), int(v), 10, 0.01);
+    probability_error = std::max(probability_error, std::abs(probability - reference));
+    num_compared++;
+  }
+  std::printf("%zu depth queries compared\n", num_compared);
+  passed &= Check("block collision probability", probability_error, 1.0e-4);
+
+  // Euclidean selection on the same scene must pick the double build's primitive
+  TrajectorySelector2D trajectory_selector;
+  trajectory_selector.InitializeLibrary(1.0);
+  trajectory_selector.GetDepthImageCollisionEvaluatorPtr()->UpdatePointCloudPtr(cloud);
+  TrajectoryLibrary* trajectory_library = trajectory_selector.GetTrajectoryLibraryPtr();
+  Matrix3 rdf_rotation;
+  rdf_rotation << 0, -1, 0, 0, 0, -1, 1, 0, 0;
+  trajectory_library->setRDFTransform(rdf_rotation, Vector3(0, 0, 0));
+  trajectory_library->setRollPitch(0.05, 0.1);
+  trajectory_library->setThrust(0.7);
+
+  size_t selection_mismatches = 0;
+  for (int speed = 0; speed < 3; speed++) {
+    for (int heading = 0; heading < 8; heading++) {
+      trajectory_library->setInitialVelocity(Vector3(1.0*speed, 0.2*speed - 0.2, 0));
+      double angle = heading*M_PI/4;
+      size_t best_traj_index;
+      Vector3 desired_acceleration;
+      trajectory_selector.computeBestEuclideanTrajectory(Vector3(5*std::cos(angle), 5*std::sin(angle), 0), best_traj_index, desired_acceleration);
+      selection_mismatches += (best_traj_index != kReferenceSelections[speed][heading]);
+    }
+  }
+  passed &= Check("selections off the reference", selection_mismatches, 0);
+
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+// Checks the terminal stop table against the exact stop offsets: interpolated lookups stay within tolerance
+// and velocities the table does not cover fall back exactly.
+// Returns non-zero if any check fails.
+
+#include "trajectory_library.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+bool Check(char const* name, double value, double tolerance) {
+  std::printf("%-36s %.3g (tolerance %.3g) %s\n", name, value, tolerance, value <= tolerance ? "ok" : "FAILED");
+  return value <= tolerance;
+}
+
+// Terminal stop positions of library, at final_time 1.0, from initial velocity
+ArrayX3 StopPositions(TrajectoryLibrary& library, Vector3 const& initial_velocity) {
+  library.setInitialVelocity(initial_velocity);
+  ArrayX3 terminal_stop_positions;
+  library.getBatch().SampleTerminalStopPositions(1.0, terminal_stop_positions);
+  return terminal_stop_positions;
+}
+
+// Table lookups stay close to the exact offsets; velocities the table does not cover must fall back exactly
+bool CheckTerminalStopTable() {
+  TrajectoryLibrary exact_library;
+  exact_library.Initialize2DLibrary(1.0);
+  TrajectoryLibrary table_library;
+  table_library.Initialize2DLibrary(1.0);
+  table_library.BuildTerminalStopTable(8.0, 32, 0.05);
+  // 2D libraries drop vertical velocity, so climbing is checked on a 3D one, which keeps the exact offsets
+  std::vector<double> final_times(1, 1.0);
+  std::vector<double> elevation_angles = {-0.3, 0.0, 0.3};
+  std::vector<double> magnitude_fractions = {1.0, 0.5};
+  TrajectoryLibrary exact_library_3d;
+  exact_library_3d.Initialize3DLibrary(final_times, 8, elevation_angles, magnitude_fractions);
+  TrajectoryLibrary table_library_3d;
+  table_library_3d.Initialize3DLibrary(final_times, 8, elevation_angles, magnitude_fractions);
+  table_library_3d.BuildTerminalStopTable(8.0, 32, 0.05);
+
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  double table_error = 0;
+  double fallback_error = 0;
+  for (int n = 0; n < 500; n++) {
+    Vector3 on_grid(7.5*uniform(generator), 7.5*uniform(generator), 0.0);
+    table_error = std::max(table_error, double((StopPositions(table_library, on_grid) - StopPositions(exact_library, on_grid)).abs().maxCoeff()));
+
+    // The table is over end-of-trajectory velocities, which are within 5 m/s of the initial one after 1 s
+    Vector3 off_grid(14.0 + uniform(generator), 2.0*uniform(generator), 0.0);
+    fallback_error = std::max(fallback_error, double((StopPositions(table_library, off_grid) - StopPositions(exact_library, off_grid)).abs().maxCoeff()));
+    Vector3 climbing(2.0*uniform(generator), 2.0*uniform(generator), 0.5);
+    fallback_error = std::max(fallback_error, double((StopPositions(table_library_3d, climbing) - StopPositions(exact_library_3d, climbing)).abs().maxCoeff()));
+  }
+  bool passed = Check("stop table lookups (m)", table_error, 0.1);
+  passed &= Check("stop table fallback (m)", fallback_error, 0.0);
+  return passed;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  return CheckTerminalStopTable() ? 0 : 1;
+}
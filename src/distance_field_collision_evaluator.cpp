@@ -0,0 +1,164 @@
+#include "distance_field_collision_evaluator.h"
+#include <limits>
+
+namespace {
+// Finite stand-in for an empty voxel, so the parabola intersections never see inf - inf
+const float kFarSquaredDistance = 1.0e20f;
+}
+
+void DistanceFieldCollisionEvaluator::setBounds(Vector3 const& min_corner, Vector3 const& max_corner, Scalar const& resolution) {
+  this->min_corner = min_corner;
+  this->resolution = resolution;
+  size_x = std::ceil((max_corner(0) - min_corner(0)) / resolution);
+  size_y = std::ceil((max_corner(1) - min_corner(1)) / resolution);
+  size_z = std::ceil((max_corner(2) - min_corner(2)) / resolution);
+  distances.assign(size_t(size_x)*size_y*size_z, kFarSquaredDistance);
+  has_frame = false;
+
+  int longest = std::max(size_x, std::max(size_y, size_z));
+  line_values.resize(longest);
+  line_output.resize(longest);
+  parabola_vertices.resize(longest);
+  parabola_boundaries.resize(longest + 1);
+}
+
+void DistanceFieldCollisionEvaluator::UpdatePointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
+  if (xyz_cloud_new == nullptr) {
+    return;
+  }
+  std::fill(distances.begin(), distances.end(), kFarSquaredDistance);
+  int i, j, k;
+  for (auto point = xyz_cloud_new->begin(); point != xyz_cloud_new->end(); point++) {
+    if (isnan(point->x)) {
+      continue;
+    }
+    if (getVoxel(Vector3(point->x, point->y, point->z), i, j, k)) {
+      distances[getVoxelIndex(i, j, k)] = 0;
+    }
+  }
+  ComputeDistanceTransform();
+  has_frame = true;
+}
+
+// Separable exact squared EDT (Felzenszwalb and Huttenlocher), one pass per axis
+void DistanceFieldCollisionEvaluator::ComputeDistanceTransform() {
+  for (int k = 0; k < size_z; k++) {
+    for (int j = 0; j < size_y; j++) {
+      DistanceTransformLine(&distances[getVoxelIndex(0, j, k)], size_x, 1);
+    }
+  }
+  for (int k = 0; k < size_z; k++) {
+    for (int i = 0; i < size_x; i++) {
+      DistanceTransformLine(&distances[getVoxelIndex(i, 0, k)], size_y, size_x);
+    }
+  }
+  for (int j = 0; j < size_y; j++) {
+    for (int i = 0; i < size_x; i++) {
+      DistanceTransformLine(&distances[getVoxelIndex(i, j, 0)], size_z, size_x*size_y);
+    }
+  }
+
+  // Voxel-centre distances can overestimate by up to one voxel diagonal (half from the return, half from the query)
+  float diagonal = std::sqrt(3.0)*resolution;
+  for (size_t index = 0; index < distances.size(); index++) {
+    if (distances[index] >= kFarSquaredDistance) {
+      distances[index] = std::numeric_limits<float>::infinity();
+      continue;
+    }
+    distances[index] = std::max(0.0f, float(std::sqrt(distances[index])*resolution) - diagonal);
+  }
+}
+
+// Lower envelope of the parabolas (q - p)^2 + line[p]
+void DistanceFieldCollisionEvaluator::DistanceTransformLine(float* line, size_t length, size_t stride) {
+  bool has_finite = false;
+  for (size_t q = 0; q < length; q++) {
+    line_values[q] = line[q*stride];
+    has_finite = has_finite || line_values[q] < kFarSquaredDistance;
+  }
+  // Lines no return reaches stay empty, which is most of them in open space
+  if (!has_finite) {
+    return;
+  }
+
+  int num_parabolas = 0;
+  parabola_vertices[0] = 0;
+  parabola_boundaries[0] = -std::numeric_limits<float>::infinity();
+  parabola_boundaries[1] = std::numeric_limits<float>::infinity();
+  for (int q = 1; q < int(length); q++) {
+    int v = parabola_vertices[num_parabolas];
+    float intersection = ((line_values[q] + q*q) - (line_values[v] + v*v)) / (2.0f*q - 2.0f*v);
+    // Stops at the first parabola, whose boundary is -inf
+    while (intersection <= parabola_boundaries[num_parabolas]) {
+      num_parabolas--;
+      v = parabola_vertices[num_parabolas];
+      intersection = ((line_values[q] + q*q) - (line_values[v] + v*v)) / (2.0f*q - 2.0f*v);
+    }
+    num_parabolas++;
+    parabola_vertices[num_parabolas] = q;
+    parabola_boundaries[num_parabolas] = intersection;
+    parabola_boundaries[num_parabolas + 1] = std::numeric_limits<float>::infinity();
+  }
+
+  int parabola = 0;
+  for (int q = 0; q < int(length); q++) {
+    while (parabola_boundaries[parabola + 1] < q) {
+      parabola++;
+    }
+    int v = parabola_vertices[parabola];
+    line_output[q] = (q - v)*(q - v) + line_values[v];
+  }
+
+  for (size_t q = 0; q < length; q++) {
+    line[q*stride] = line_output[q];
+  }
+}
+
+bool DistanceFieldCollisionEvaluator::getVoxel(Vector3 const& position, int &i, int &j, int &k) const {
+  Vector3 voxel = (position - min_corner) / resolution;
+  // Compare before converting, so far-away positions cannot overflow the ints
+  if (!(voxel(0) >= 0 && voxel(0) < size_x && voxel(1) >= 0 && voxel(1) < size_y && voxel(2) >= 0 && voxel(2) < size_z)) {
+    return false;
+  }
+  i = voxel(0);
+  j = voxel(1);
+  k = voxel(2);
+  return true;
+}
+
+Scalar DistanceFieldCollisionEvaluator::getDistance(Vector3 const& position) const {
+  int i, j, k;
+  if (!has_frame || !getVoxel(position, i, j, k)) {
+    return std::numeric_limits<Scalar>::infinity();
+  }
+  return distances[getVoxelIndex(i, j, k)];
+}
+
+Scalar DistanceFieldCollisionEvaluator::computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position) const {
+  int i, j, k;
+  if (!has_frame) {
+    return 0.0;
+  }
+  if (!getVoxel(robot_position, i, j, k)) {
+    return probability_of_collision_in_unknown;
+  }
+  Scalar distance = distances[getVoxelIndex(i, j, k)];
+  if (distance == std::numeric_limits<float>::infinity()) {
+    return 0.0;
+  }
+
+  // P(offset along the normal > distance - robot_radius) for a Gaussian offset; sigmas are variances, as elsewhere
+  Scalar sigma_normal = std::sqrt((sigma_robot_position + sigma_depth_point).maxCoeff());
+  return 0.5*std::erfc((distance - robot_radius) / (sigma_normal*std::sqrt(2.0)));
+}
+
+void DistanceFieldCollisionEvaluator::EvaluateBatch(TrajectorySamples const& samples, Vector3 const& sigma_robot_position, size_t const& trajectory_stride, Eigen::Ref<VectorX> probabilities) const {
+  for (size_t i = 0; i < samples.getNumTrajectories(); i += trajectory_stride) {
+    Scalar probability_no_collision = 1;
+    for (size_t t = 0; t < samples.getNumSamples(); t++) {
+      Scalar probability_no_collision_one_step = 1.0 - computeProbabilityOfCollisionOnePosition(samples.getSample(i, t), sigma_robot_position);
+      probability_no_collision = probability_no_collision * probability_no_collision_one_step;
+    }
+    probabilities(i) = 1 - probability_no_collision;
+  }
+}
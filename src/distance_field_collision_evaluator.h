@@ -0,0 +1,70 @@
+#ifndef DISTANCE_FIELD_COLLISION_EVALUATOR_H
+#define DISTANCE_FIELD_COLLISION_EVALUATOR_H
+
+#include <iostream>
+#include <math.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "trajectory.h"
+#include "trajectory_batch.h"
+
+#include <vector>
+
+// Egocentric Euclidean distance field over a box of the depth sensor's RDF frame, rebuilt once per depth frame.
+// A query is then one voxel lookup and one closed-form Gaussian, independent of any image window:
+// the nearest return is treated as a plane at the looked-up distance, and the position uncertainty along its
+// normal taken as the largest of sigma_robot_position + sigma_depth_point.
+class DistanceFieldCollisionEvaluator {
+public:
+	DistanceFieldCollisionEvaluator() {
+		setBounds(Vector3(-5.0, -2.0, 0.0), Vector3(5.0, 2.0, 10.0), 0.1);
+	}
+
+  // Voxels of edge resolution covering [min_corner, max_corner]; clears the field
+  void setBounds(Vector3 const& min_corner, Vector3 const& max_corner, Scalar const& resolution);
+
+  void UpdatePointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new);
+
+  // Lower bound on the distance from position to the nearest return; infinite if the frame had none
+  Scalar getDistance(Vector3 const& position) const;
+
+  Scalar computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position) const;
+
+  // Same contract as DepthImageCollisionEvaluator::EvaluateBatch
+  void EvaluateBatch(TrajectorySamples const& samples, Vector3 const& sigma_robot_position, size_t const& trajectory_stride, Eigen::Ref<VectorX> probabilities) const;
+
+private:
+
+  void ComputeDistanceTransform();
+  void DistanceTransformLine(float* line, size_t length, size_t stride);
+
+  size_t getVoxelIndex(int i, int j, int k) const {
+    return (k*size_y + j)*size_x + i;
+  };
+  bool getVoxel(Vector3 const& position, int &i, int &j, int &k) const;
+
+  Vector3 min_corner;
+  Scalar resolution;
+  int size_x = 0;
+  int size_y = 0;
+  int size_z = 0;
+  bool has_frame = false;
+
+  // Squared distances in voxels while building, metres afterwards
+  std::vector<float> distances;
+
+  // Scratch for the 1D transforms
+  std::vector<float> line_values;
+  std::vector<float> line_output;
+  std::vector<int> parabola_vertices;
+  std::vector<float> parabola_boundaries;
+
+  Vector3 sigma_depth_point = Vector3(0.1, 0.1, 0.1);
+  Scalar robot_radius = 0.4;
+  Scalar probability_of_collision_in_unknown = 0.0;
+
+};
+
+#endif
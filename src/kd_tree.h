@@ -1,3 +1,6 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
 #include <iostream>
 #include "nanoflann.hpp"
 
@@ -5,25 +8,31 @@
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 
+#include <array>
 #include <chrono>
+#include <vector>
 
 
 
+// Indexes the received cloud in place: the tree's point i is cloud->points[valid_indices[i]], so only the
+// indices of returns are copied, into storage that is reused across frames
 template <typename T>
-struct PointCloud
+struct PCLPointCloudAdaptor
 {
 
-	std::vector<pcl::PointXYZ>  pts;
+	pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud;
+	std::vector<size_t> valid_indices;
 
 	// Must return the number of data points
-	inline size_t kdtree_get_point_count() const { return pts.size(); }
+	inline size_t kdtree_get_point_count() const { return valid_indices.size(); }
 
 	// Returns the distance between the vector "p1[0:size-1]" and the data point with index "idx_p2" stored in the class:
 	inline T kdtree_distance(const T *p1, const size_t idx_p2,size_t /*size*/) const
 	{
-		const T d0=p1[0]-pts[idx_p2].x;
-		const T d1=p1[1]-pts[idx_p2].y;
-		const T d2=p1[2]-pts[idx_p2].z;
+		pcl::PointXYZ const& point = cloud->points[valid_indices[idx_p2]];
+		const T d0=p1[0]-point.x;
+		const T d1=p1[1]-point.y;
+		const T d2=p1[2]-point.z;
 		return d0*d0+d1*d1+d2*d2;
 	}
 
@@ -32,9 +41,10 @@ struct PointCloud
 	//  "if/else's" are actually solved at compile time.
 	inline T kdtree_get_pt(const size_t idx, int dim) const
 	{
-		if (dim==0) return pts[idx].x;
-		else if (dim==1) return pts[idx].y;
-		else return pts[idx].z;
+		pcl::PointXYZ const& point = cloud->points[valid_indices[idx]];
+		if (dim==0) return point.x;
+		else if (dim==1) return point.y;
+		else return point.z;
 	}
 
 	// Optional bounding-box computation: return false to default to a standard bbox computation loop.
@@ -49,77 +59,77 @@ template <typename num_t>
 class KDTree {
 public:
 	typedef nanoflann::KDTreeSingleIndexAdaptor<
-	nanoflann::L2_Simple_Adaptor<num_t, PointCloud<num_t> > ,
-	PointCloud<num_t>,
+	nanoflann::L2_Simple_Adaptor<num_t, PCLPointCloudAdaptor<num_t> > ,
+	PCLPointCloudAdaptor<num_t>,
 	3 /* dim */
 	> my_kd_tree_t;
 
 	KDTree() : cloud(), index(3, cloud, nanoflann::KDTreeSingleIndexAdaptorParams(10 /* max leaf */)) { };
 
-	void Initialize(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
-		using namespace std;
-		using namespace nanoflann;
-		cloud.pts.clear();
+	// Keeps a reference to xyz_cloud_new, which must not be modified while the tree is in use
+	void Initialize(pcl::PointCloud<pcl::PointXYZ>::ConstPtr const& xyz_cloud_new) {
+		cloud.cloud = xyz_cloud_new;
+		cloud.valid_indices.clear();
 
-	  // Make a PointCloud from a pcl pointcloud
 		size_t num_points = xyz_cloud_new->points.size();
+		cloud.valid_indices.reserve(num_points);
 		for (size_t i = 0; i < num_points; i++) {
 			if ( !(xyz_cloud_new->points[i].x != xyz_cloud_new->points[i].x) ) {
-				cloud.pts.push_back(xyz_cloud_new->points[i]);
+				cloud.valid_indices.push_back(i);
 			}
 		}
 
-	  // cloud.pts = xyz_cloud_new;
-	  //std::cout << cloud.pts.size() << " is how many pts I ended up with" << std::endl;
-
-	  // construct a kd-tree index:
-
-	// index = my_kd_tree_t(3 /*dim*/, cloud, KDTreeSingleIndexAdaptorParams(10 /* max leaf */) );
-	index.buildIndex();
-
-	  //   std::cout << "knnSearch(nn="<<num_results<<"): \n";
-	  //   std::cout << "ret_index=" << ret_index << " out_dist_sqr=" << out_dist_sqr << endl;
-	  // }
-	  // {
-	  //   // Unsorted radius search:
-	  //   const num_t radius = 1;
-	  //   std::vector<std::pair<size_t,num_t> > indices_dists;
-	  //   RadiusResultSet<num_t,size_t> resultSet(radius,indices_dists);
-
-	  //   index.findNeighbors(resultSet, query_pt, nanoflann::SearchParams());
-
-	  //   // Get worst (furthest) point, without sorting:
-	  //   std::pair<size_t,num_t> worst_pair = resultSet.worst_item();
-	  //   cout << "Worst pair: idx=" << worst_pair.first << " dist=" << worst_pair.second << endl;
-	  // }
+		// The index is kept across frames, so its permutation array is rebuilt in place
+		index.buildIndex();
+	}
 
+	size_t getNumPoints() const {
+		return cloud.valid_indices.size();
 	}
 
+// Fills the first n entries of the outputs, nearest first, and returns how many were found
 template <int n>
-void SearchForNearest(num_t x, num_t y, num_t z, std::vector<pcl::PointXYZ>& closest_pts, std::vector<num_t>& squared_distances) {
-	if (cloud.pts.size() > 0) {
+size_t SearchForNearest(num_t x, num_t y, num_t z, std::array<pcl::PointXYZ, n>& closest_pts, std::array<num_t, n>& squared_distances) const {
+	if (cloud.valid_indices.empty()) {
+		return 0;
+	}
 
-		closest_pts.clear();
-		squared_distances.clear();
+	num_t query_pt[3] = { x, y, z};
 
-		num_t query_pt[3] = { x, y, z};
+    size_t ret_index[n];
+    nanoflann::KNNResultSet<num_t> resultSet(n);
+    resultSet.init(&ret_index[0], squared_distances.data());
+    nanoflann::SearchParams params(10);
+    index.findNeighbors(resultSet, &query_pt[0], params);
 
-	    size_t ret_index[n];
-	    num_t out_dist_sqr[n];
-	    nanoflann::KNNResultSet<num_t> resultSet(n);
-	    resultSet.init(&ret_index[0], &out_dist_sqr[0] );
-	    nanoflann::SearchParams params(10);
-	    index.findNeighbors(resultSet, &query_pt[0], params);
+    size_t num_found = resultSet.size();
+    for (size_t i = 0; i < num_found; i++) {
+    	closest_pts[i] = cloud.cloud->points[cloud.valid_indices[ret_index[i]]];
+    }
+    return num_found;
+}
 
-	    for (size_t i = 0; i < n; i++) {
-	    	closest_pts.push_back(cloud.pts[ret_index[i]]);
-	    	squared_distances.push_back(out_dist_sqr[i]);
-	    }
+// Every point closer than radius, unsorted, as (point index, squared distance); indices_distances keeps its
+// capacity across queries
+size_t SearchWithinRadius(num_t x, num_t y, num_t z, num_t radius, std::vector<std::pair<size_t, num_t> >& indices_distances) const {
+	indices_distances.clear();
+	if (cloud.valid_indices.empty()) {
+		return 0;
 	}
 
+	num_t query_pt[3] = { x, y, z};
+	nanoflann::RadiusResultSet<num_t, size_t> resultSet(radius*radius, indices_distances);
+	index.findNeighbors(resultSet, &query_pt[0], nanoflann::SearchParams(10, 0, false));
+	return resultSet.size();
+}
+
+pcl::PointXYZ const& getPoint(size_t index) const {
+	return cloud.cloud->points[cloud.valid_indices[index]];
 }
 
 private:
-	PointCloud<num_t> cloud;
+	PCLPointCloudAdaptor<num_t> cloud;
 	my_kd_tree_t index;
-};
\ No newline at end of file
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "kd_tree_collision_evaluator.h"
+
+void KDTreeCollisionEvaluator::UpdatePointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
+  xyz_cloud_ptr = xyz_cloud_new;
+  if (xyz_cloud_ptr == nullptr) {
+    return;
+  }
+  kd_tree.Initialize(xyz_cloud_ptr);
+}
+
+// The ball covers the Gaussian's num_sigmas support along its widest axis; sigmas are variances, as in the block kernel
+Scalar KDTreeCollisionEvaluator::computeNoCollisionProbability(Vector3 const& robot_position, Vector3 const& inverse_total_sigma, Scalar const& coefficient, Scalar const& search_radius, std::vector<std::pair<size_t, Scalar> >& neighbours) const {
+  kd_tree.SearchWithinRadius(robot_position(0), robot_position(1), robot_position(2), search_radius, neighbours);
+
+  Scalar probability_no_collision = 1;
+  for (size_t n = 0; n < neighbours.size(); n++) {
+    pcl::PointXYZ const& point = kd_tree.getPoint(neighbours[n].first);
+    Vector3 depth_position = Vector3(point.x, point.y, point.z);
+    Scalar exponent = -0.5*(robot_position - depth_position).transpose() * inverse_total_sigma.cwiseProduct(robot_position - depth_position);
+    probability_no_collision = probability_no_collision* (1 - coefficient * std::exp(exponent));
+  }
+  return probability_no_collision;
+}
+
+Scalar KDTreeCollisionEvaluator::computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position) {
+  if (xyz_cloud_ptr == nullptr) {
+    return 0.0;
+  }
+  Vector3 total_sigma = sigma_robot_position + sigma_depth_point;
+  Vector3 inverse_total_sigma = Vector3(1/total_sigma(0), 1/total_sigma(1), 1/total_sigma(2));
+  Scalar volume = 0.267; // 4/3*pi*r^3, with r=0.4 as first guess
+  Scalar denominator = std::sqrt( 248.05021344239853*(total_sigma(0))*(total_sigma(1))*(total_sigma(2)) ); // coefficient is 2pi*2pi*2pi
+  Scalar search_radius = search_sigmas*std::sqrt(total_sigma.maxCoeff());
+
+  return 1 - computeNoCollisionProbability(robot_position, inverse_total_sigma, volume / denominator, search_radius, neighbours);
+}
+
+void KDTreeCollisionEvaluator::EvaluateBatch(TrajectorySamples const& samples, Vector3 const& sigma_robot_position, size_t const& trajectory_stride, Eigen::Ref<VectorX> probabilities, WorkerPool* worker_pool) {
+  size_t num_trajectories = samples.getNumTrajectories();
+  if (xyz_cloud_ptr == nullptr) {
+    for (size_t i = 0; i < num_trajectories; i += trajectory_stride) {
+      probabilities(i) = 0.0;
+    }
+    return;
+  }
+
+  // Shared by every query of the batch
+  Vector3 total_sigma = sigma_robot_position + sigma_depth_point;
+  Vector3 inverse_total_sigma = Vector3(1/total_sigma(0), 1/total_sigma(1), 1/total_sigma(2));
+  Scalar volume = 0.267; // 4/3*pi*r^3, with r=0.4 as first guess
+  Scalar denominator = std::sqrt( 248.05021344239853*(total_sigma(0))*(total_sigma(1))*(total_sigma(2)) ); // coefficient is 2pi*2pi*2pi
+  Scalar coefficient = volume / denominator;
+  Scalar search_radius = search_sigmas*std::sqrt(total_sigma.maxCoeff());
+
+  // One primitive per chunk, its samples in time order, so the result does not depend on the thread count.
+  // Each chunk keeps its own neighbour buffer across ticks.
+  size_t num_chunks = (num_trajectories + trajectory_stride - 1) / trajectory_stride;
+  if (chunk_neighbours.size() < num_chunks) {
+    chunk_neighbours.resize(num_chunks);
+  }
+  auto evaluate_trajectory = [&](size_t chunk) {
+    size_t i = chunk*trajectory_stride;
+    Scalar probability_no_collision = 1;
+    for (size_t t = 0; t < samples.getNumSamples(); t++) {
+      Scalar probability_no_collision_one_step = computeNoCollisionProbability(samples.getSample(i, t), inverse_total_sigma, coefficient, search_radius, chunk_neighbours[chunk]);
+      probability_no_collision = probability_no_collision * probability_no_collision_one_step;
+    }
+    probabilities(i) = 1 - probability_no_collision;
+  };
+  if (worker_pool != nullptr) {
+    worker_pool->ParallelFor(num_chunks, evaluate_trajectory);
+  }
+  else {
+    for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+      evaluate_trajectory(chunk);
+    }
+  }
+}
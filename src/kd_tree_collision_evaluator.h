@@ -0,0 +1,49 @@
+#ifndef KD_TREE_COLLISION_EVALUATOR_H
+#define KD_TREE_COLLISION_EVALUATOR_H
+
+#include <iostream>
+#include <math.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "trajectory.h"
+#include "trajectory_batch.h"
+#include "kd_tree.h"
+#include "worker_pool.h"
+
+#include <utility>
+#include <vector>
+
+// The depth image block kernel over every return within num_sigmas standard deviations of the query, found by a
+// kd-tree radius search. Needs no image structure, so the cloud may be unorganized or merged from several sensors.
+class KDTreeCollisionEvaluator {
+public:
+
+  // Builds the tree over the returns of xyz_cloud_new, which must not be modified while it is in use
+  void UpdatePointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new);
+
+  void setSearchSigmas(Scalar const& num_sigmas) {
+    search_sigmas = num_sigmas;
+  };
+
+  Scalar computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
+
+  // Same contract as DepthImageCollisionEvaluator::EvaluateBatch; primitives are split across worker_pool if given
+  void EvaluateBatch(TrajectorySamples const& samples, Vector3 const& sigma_robot_position, size_t const& trajectory_stride, Eigen::Ref<VectorX> probabilities, WorkerPool* worker_pool = nullptr);
+
+private:
+
+  Scalar computeNoCollisionProbability(Vector3 const& robot_position, Vector3 const& inverse_total_sigma, Scalar const& coefficient, Scalar const& search_radius, std::vector<std::pair<size_t, Scalar> >& neighbours) const;
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr xyz_cloud_ptr;
+  KDTree<Scalar> kd_tree;
+  std::vector<std::pair<size_t, Scalar> > neighbours;
+  std::vector<std::vector<std::pair<size_t, Scalar> > > chunk_neighbours;
+
+  Vector3 sigma_depth_point = Vector3(0.1, 0.1, 0.1);
+  Scalar search_sigmas = 3.0;
+
+};
+
+#endif
@@ -1,9 +1,37 @@
 #include "laser_scan_collision_evaluator.h"
 
+#include <algorithm>
+
 
 void LaserScanCollisionEvaluator::UpdatePointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
 	//auto t1 = std::chrono::high_resolution_clock::now();
 	xyz_cloud_ptr = xyz_cloud_new;
+	grid_points.clear();
+	grid_point_keys.clear();
+	grid_cells.clear();
+	if (xyz_cloud_ptr == nullptr) {
+		return;
+	}
+
+	// Bin the returns by cell, skipping NaNs
+	for (auto point = xyz_cloud_ptr->begin(); point != xyz_cloud_ptr->end(); point++) {
+		if (!(point->x == point->x) || !(point->y == point->y) || !(point->z == point->z)) {
+			continue;
+		}
+		uint64_t key = CellKey(CellIndex(point->x), CellIndex(point->y), CellIndex(point->z));
+		grid_point_keys.push_back(std::make_pair(key, size_t(point - xyz_cloud_ptr->begin())));
+	}
+	std::sort(grid_point_keys.begin(), grid_point_keys.end());
+
+	grid_points.reserve(grid_point_keys.size());
+	for (size_t n = 0; n < grid_point_keys.size(); n++) {
+		pcl::PointXYZ const& point = xyz_cloud_ptr->points[grid_point_keys[n].second];
+		grid_points.push_back(Vector3(point.x, point.y, point.z));
+		if (n == 0 || grid_point_keys[n].first != grid_point_keys[n-1].first) {
+			grid_cells[grid_point_keys[n].first] = std::make_pair(n, n);
+		}
+		grid_cells[grid_point_keys[n].first].second = n + 1;
+	}
 	// auto t2 = std::chrono::high_resolution_clock::now();
 	// std::cout << "Converting and saving the point cloud took "
  //      << std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count()
@@ -12,44 +40,52 @@ void LaserScanCollisionEvaluator::UpdatePointCloudPtr(pcl::PointCloud<pcl::Point
 
 
 
-double LaserScanCollisionEvaluator::computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position) {
+Scalar LaserScanCollisionEvaluator::computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position) {
 	//std::cout << "Robot position given" << robot_position << std::endl;
 	//std::cout << "sigma_robot_position given" << sigma_robot_position << std::endl;
-	double closest_distance = 100;
-	double current_distance;
-
-	double probability_no_collision = 1.0;
-	double probability_of_collision_one_return;
+	Scalar probability_no_collision = 1.0;
+	Scalar probability_of_collision_one_return;
 
 
 	Vector3 total_sigma = sigma_robot_position + sigma_depth_point;
   	Vector3 inverse_total_sigma = Vector3(1/total_sigma(0), 1/total_sigma(1), 1/total_sigma(2));
-  	double volume = 0.2*0.267; // 4/3*pi*r^3, with r=0.4 as first guess
-  	double denominator = std::sqrt( 248.05021344239853*(total_sigma(0))*(total_sigma(1))*(total_sigma(2)) ); // coefficient is 2pi*2pi*2pi	
-	
-	if (xyz_cloud_ptr != nullptr) {
+  	Scalar volume = 0.2*0.267; // 4/3*pi*r^3, with r=0.4 as first guess
+  	Scalar denominator = std::sqrt( 248.05021344239853*(total_sigma(0))*(total_sigma(1))*(total_sigma(2)) ); // coefficient is 2pi*2pi*2pi	
+	Scalar coefficient = volume / denominator;
 
-		auto point_cloud_iterator_begin = xyz_cloud_ptr->begin();
-  		auto point_cloud_iterator_end = xyz_cloud_ptr->end();
-  		for (auto point = point_cloud_iterator_begin; point != point_cloud_iterator_end; point++) {
-  			Vector3 depth_position = Vector3(point->x, point->y, point->z);
-
-  			current_distance = (depth_position - robot_position).norm();
-  			if (current_distance < closest_distance) {
-  				closest_distance = current_distance;
-  			}
-
-  			double exponent = -0.5*(robot_position - depth_position).transpose() * inverse_total_sigma.cwiseProduct(robot_position - depth_position);
-  			probability_of_collision_one_return = volume / denominator * std::exp(exponent);
-  			//std::cout << "probability_of_collision_one_return " << probability_of_collision_one_return << std::endl;
-  			if (probability_of_collision_one_return < 0.02) {probability_of_collision_one_return=0.0;}
-  			probability_no_collision = probability_no_collision * (1 - probability_of_collision_one_return);
-  		}
+	if (xyz_cloud_ptr != nullptr) {
 
-  		// if (closest_distance < 0.5) {
-  		// 	std::cout << "My closest distance was " << closest_distance << std::endl;
-  		// 	std::cout << "probability_no_collision was " << probability_no_collision << std::endl;
-  		// }
+		// coefficient*exp(-0.5*d'*inverse_total_sigma*d) falls below the threshold once |d|^2 exceeds
+		// 2*max(total_sigma)*log(coefficient/threshold), so only cells within that radius can contribute
+		if (coefficient < probability_threshold) {
+			return 0.0;
+		}
+		Scalar cutoff_radius = std::sqrt(2*total_sigma.maxCoeff()*std::log(coefficient / probability_threshold));
+
+		int64_t i_begin = CellIndex(robot_position(0) - cutoff_radius);
+		int64_t i_end = CellIndex(robot_position(0) + cutoff_radius);
+		int64_t j_begin = CellIndex(robot_position(1) - cutoff_radius);
+		int64_t j_end = CellIndex(robot_position(1) + cutoff_radius);
+		int64_t k_begin = CellIndex(robot_position(2) - cutoff_radius);
+		int64_t k_end = CellIndex(robot_position(2) + cutoff_radius);
+
+		for (int64_t i = i_begin; i <= i_end; i++) {
+			for (int64_t j = j_begin; j <= j_end; j++) {
+				for (int64_t k = k_begin; k <= k_end; k++) {
+					auto cell = grid_cells.find(CellKey(i, j, k));
+					if (cell == grid_cells.end()) {
+						continue;
+					}
+					for (size_t n = cell->second.first; n < cell->second.second; n++) {
+						Vector3 const& depth_position = grid_points[n];
+						Scalar exponent = -0.5*(robot_position - depth_position).transpose() * inverse_total_sigma.cwiseProduct(robot_position - depth_position);
+						probability_of_collision_one_return = coefficient * std::exp(exponent);
+						if (probability_of_collision_one_return < probability_threshold) {probability_of_collision_one_return=0.0;}
+						probability_no_collision = probability_no_collision * (1 - probability_of_collision_one_return);
+					}
+				}
+			}
+		}
 
 		return 1 - probability_no_collision;	
 	}
@@ -8,18 +8,39 @@
 #include "trajectory.h"
 
 #include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 class LaserScanCollisionEvaluator {
 public:
 	
   void UpdatePointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new);
-  double computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
+  Scalar computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
   Eigen::Matrix<Scalar, 100, 3> DebugPointsToDraw();
   
 
 private:
+  static uint64_t CellKey(int64_t i, int64_t j, int64_t k) {
+    return (uint64_t(i & 0x1FFFFF) << 42) | (uint64_t(j & 0x1FFFFF) << 21) | uint64_t(k & 0x1FFFFF);
+  };
+  int64_t CellIndex(Scalar const& coordinate) const {
+    return int64_t(std::floor(coordinate / grid_cell_size));
+  };
+
   pcl::PointCloud<pcl::PointXYZ>::Ptr xyz_cloud_ptr;
 
+  // Uniform grid over the scan's returns, rebuilt by UpdatePointCloudPtr: grid_points is sorted by cell and
+  // grid_cells maps a cell key to its [begin, end) range. Storage is reused across scans.
+  Scalar grid_cell_size = 0.5;
+  std::vector<Vector3> grid_points;
+  std::vector<std::pair<uint64_t, size_t> > grid_point_keys;
+  std::unordered_map<uint64_t, std::pair<size_t, size_t> > grid_cells;
+
+  // Single-return probabilities below this are dropped
+  Scalar probability_threshold = 0.02;
+
   Vector3 sigma_depth_point = Vector3(0.1, 0.1, 0.1);
 
 };
\ No newline at end of file
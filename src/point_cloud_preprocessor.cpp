@@ -0,0 +1,144 @@
+#include "point_cloud_preprocessor.h"
+
+#include <algorithm>
+#include <random>
+
+void PointCloudPreprocessor::Process(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud) {
+  if (xyz_cloud == nullptr) {
+    return;
+  }
+  ClipRange(*xyz_cloud);
+  has_ground_plane = false;
+  if (ground_removal) {
+    FitGroundPlane(*xyz_cloud);
+    RemoveGround(*xyz_cloud);
+  }
+  if (voxel_size > 0) {
+    Downsample(*xyz_cloud);
+    output_cloud = downsampled_cloud;
+  }
+  else {
+    output_cloud = xyz_cloud;
+  }
+}
+
+void PointCloudPreprocessor::ClipRange(pcl::PointCloud<pcl::PointXYZ>& xyz_cloud) const {
+  if (min_range <= 0 && max_range == std::numeric_limits<Scalar>::infinity()) {
+    return;
+  }
+  Scalar min_range_squared = min_range*min_range;
+  Scalar max_range_squared = max_range*max_range;
+  for (auto point = xyz_cloud.begin(); point != xyz_cloud.end(); point++) {
+    Scalar range_squared = Scalar(point->x)*point->x + Scalar(point->y)*point->y + Scalar(point->z)*point->z;
+    if (range_squared < min_range_squared || range_squared > max_range_squared) {
+      SetNoReturn(*point);
+    }
+  }
+}
+
+// Fixed seed, so a frame always gives the same plane
+void PointCloudPreprocessor::FitGroundPlane(pcl::PointCloud<pcl::PointXYZ> const& xyz_cloud) {
+  size_t width = xyz_cloud.width;
+  size_t height = xyz_cloud.height;
+  if (height <= 1) {
+    width = xyz_cloud.points.size();
+    height = 1;
+  }
+
+  ground_samples.clear();
+  for (size_t j = 0; j < height; j += (height > 1 ? ground_sample_stride : 1)) {
+    for (size_t i = 0; i < width; i += ground_sample_stride) {
+      pcl::PointXYZ const& point = xyz_cloud.points[j*width + i];
+      if (!IsNoReturn(point)) {
+        ground_samples.push_back(Vector3(point.x, point.y, point.z));
+      }
+    }
+  }
+  if (ground_samples.size() < 3) {
+    return;
+  }
+
+  std::minstd_rand generator(1);
+  std::uniform_int_distribution<size_t> pick(0, ground_samples.size() - 1);
+  Scalar min_cos_tilt = std::cos(ground_max_tilt);
+  size_t best_inliers = 0;
+  for (size_t iteration = 0; iteration < ground_iterations; iteration++) {
+    Vector3 const& a = ground_samples[pick(generator)];
+    Vector3 const& b = ground_samples[pick(generator)];
+    Vector3 const& c = ground_samples[pick(generator)];
+    Vector3 normal = (b - a).cross(c - a);
+    Scalar norm = normal.norm();
+    if (norm < 1.0e-6) {
+      continue;
+    }
+    normal /= norm;
+    if (normal.dot(sensor_up) < 0) {
+      normal = -normal;
+    }
+    Scalar offset = -normal.dot(a);
+    // The sensor must be above the plane, and the plane close to level
+    if (normal.dot(sensor_up) < min_cos_tilt || offset < ground_tolerance) {
+      continue;
+    }
+
+    size_t inliers = 0;
+    for (size_t n = 0; n < ground_samples.size(); n++) {
+      if (std::abs(normal.dot(ground_samples[n]) + offset) < ground_tolerance) {
+        inliers++;
+      }
+    }
+    if (inliers > best_inliers) {
+      best_inliers = inliers;
+      ground_normal = normal;
+      ground_offset = offset;
+    }
+  }
+  has_ground_plane = best_inliers >= ground_min_inlier_fraction*ground_samples.size();
+}
+
+void PointCloudPreprocessor::RemoveGround(pcl::PointCloud<pcl::PointXYZ>& xyz_cloud) const {
+  if (!has_ground_plane) {
+    return;
+  }
+  for (auto point = xyz_cloud.begin(); point != xyz_cloud.end(); point++) {
+    if (ground_normal.dot(Vector3(point->x, point->y, point->z)) + ground_offset < ground_tolerance) {
+      SetNoReturn(*point);
+    }
+  }
+}
+
+void PointCloudPreprocessor::Downsample(pcl::PointCloud<pcl::PointXYZ> const& xyz_cloud) {
+  auto& output = downsampled_cloud->points;
+  output.clear();
+
+  // Sort the returns by voxel, then average each run
+  voxel_keys.clear();
+  for (auto point = xyz_cloud.begin(); point != xyz_cloud.end(); point++) {
+    if (IsNoReturn(*point)) {
+      continue;
+    }
+    uint64_t i = uint64_t(int64_t(std::floor(point->x / voxel_size))) & 0x1FFFFF;
+    uint64_t j = uint64_t(int64_t(std::floor(point->y / voxel_size))) & 0x1FFFFF;
+    uint64_t k = uint64_t(int64_t(std::floor(point->z / voxel_size))) & 0x1FFFFF;
+    voxel_keys.push_back(std::make_pair((i << 42) | (j << 21) | k, size_t(point - xyz_cloud.begin())));
+  }
+  std::sort(voxel_keys.begin(), voxel_keys.end());
+
+  size_t run_begin = 0;
+  while (run_begin < voxel_keys.size()) {
+    size_t run_end = run_begin;
+    Vector3 sum = Vector3::Zero();
+    while (run_end < voxel_keys.size() && voxel_keys[run_end].first == voxel_keys[run_begin].first) {
+      pcl::PointXYZ const& point = xyz_cloud.points[voxel_keys[run_end].second];
+      sum += Vector3(point.x, point.y, point.z);
+      run_end++;
+    }
+    Vector3 centroid = sum / Scalar(run_end - run_begin);
+    output.push_back(pcl::PointXYZ(centroid(0), centroid(1), centroid(2)));
+    run_begin = run_end;
+  }
+
+  downsampled_cloud->width = output.size();
+  downsampled_cloud->height = 1;
+  downsampled_cloud->is_dense = true;
+}
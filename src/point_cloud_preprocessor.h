@@ -0,0 +1,96 @@
+#ifndef POINT_CLOUD_PREPROCESSOR_H
+#define POINT_CLOUD_PREPROCESSOR_H
+
+#include <iostream>
+#include <math.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "trajectory.h"
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Once-per-frame cleanup of a sensor cloud in its RDF (optical) frame, ahead of the collision evaluators.
+// Range clipping and ground removal mark rejected returns as no-return (NaN) in place, so the cloud stays
+// organized for the depth image evaluator; the voxel-downsampled copy is for the evaluators that take any cloud.
+// Without voxels those evaluators get the filtered input cloud itself, no-returns included.
+class PointCloudPreprocessor {
+public:
+
+  // Returns outside [min_range, max_range] of the sensor are dropped
+  void setRangeLimits(Scalar const& min_range, Scalar const& max_range) {
+    this->min_range = min_range;
+    this->max_range = max_range;
+  };
+
+  // Drops returns within tolerance of, or below, the dominant plane whose normal is within max_tilt (rad) of the
+  // sensor's up axis (-y) and which passes below the sensor. The plane is a RANSAC fit over every
+  // ground_sample_stride'th pixel, so the cloud is expected to be organized.
+  void setGroundRemoval(bool const& enabled, Scalar const& tolerance, Scalar const& max_tilt) {
+    ground_removal = enabled;
+    ground_tolerance = tolerance;
+    ground_max_tilt = max_tilt;
+  };
+
+  // Edge length of the downsampling voxels; 0 passes the filtered input cloud through without a copy
+  void setVoxelSize(Scalar const& voxel_size) {
+    this->voxel_size = voxel_size;
+  };
+
+  // Filters xyz_cloud in place and, with a voxel size, rebuilds the downsampled cloud from it
+  void Process(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud);
+
+  // Centroid of the returns in each occupied voxel, unorganized; reused, so it changes on the next Process.
+  // With voxel_size 0, the cloud last given to Process.
+  pcl::PointCloud<pcl::PointXYZ>::Ptr const& getDownsampledCloud() const {
+    return output_cloud;
+  };
+
+  bool getGroundPlane(Vector3& normal, Scalar& offset) const {
+    normal = ground_normal;
+    offset = ground_offset;
+    return has_ground_plane;
+  };
+
+private:
+  void ClipRange(pcl::PointCloud<pcl::PointXYZ>& xyz_cloud) const;
+  void FitGroundPlane(pcl::PointCloud<pcl::PointXYZ> const& xyz_cloud);
+  void RemoveGround(pcl::PointCloud<pcl::PointXYZ>& xyz_cloud) const;
+  void Downsample(pcl::PointCloud<pcl::PointXYZ> const& xyz_cloud);
+
+  static bool IsNoReturn(pcl::PointXYZ const& point) {
+    return !(point.x == point.x) || !(point.y == point.y) || !(point.z == point.z);
+  };
+  static void SetNoReturn(pcl::PointXYZ& point) {
+    point.x = point.y = point.z = std::numeric_limits<float>::quiet_NaN();
+  };
+
+  Scalar min_range = 0.0;
+  Scalar max_range = std::numeric_limits<Scalar>::infinity();
+
+  bool ground_removal = false;
+  Scalar ground_tolerance = 0.1;
+  Scalar ground_max_tilt = 0.35;
+  Vector3 sensor_up = Vector3(0.0, -1.0, 0.0);
+  size_t ground_sample_stride = 4;
+  size_t ground_iterations = 64;
+  Scalar ground_min_inlier_fraction = 0.1;
+
+  // normal.dot(p) + offset is the height of p above the last accepted plane
+  bool has_ground_plane = false;
+  Vector3 ground_normal = Vector3(0.0, -1.0, 0.0);
+  Scalar ground_offset = 0.0;
+  std::vector<Vector3> ground_samples;
+
+  Scalar voxel_size = 0.0;
+  std::vector<std::pair<uint64_t, size_t> > voxel_keys;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr downsampled_cloud = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>);
+  pcl::PointCloud<pcl::PointXYZ>::Ptr output_cloud = downsampled_cloud;
+
+};
+
+#endif
@@ -1,199 +1,90 @@
 #include "trajectory.h"
 
-void Trajectory::setAccelerationMax(double const& acceleration_max) {
-  this->a_max_horizontal = acceleration_max;
+void TrajectoryInitialState::setInitialAcceleration(Vector3 const& initial_acceleration) {
+  this->initial_acceleration = initial_acceleration;
+  updateEndOfJerkTime();
 };
 
-void Trajectory::setAcceleration(Vector3 const& acceleration) {
-  this->acceleration = acceleration;
+void TrajectoryInitialState::setInitialVelocity(Vector3 const& initial_velocity) {
+  this->initial_velocity = initial_velocity;
+  updateEndOfJerkTime();
 };
 
-void Trajectory::setInitialAcceleration(Vector3 const& initial_acceleration_to_set) {
-  initial_acceleration = initial_acceleration_to_set;
-  jerk = (acceleration - initial_acceleration) / jerk_time;
-  position_end_of_jerk_time = 0.1666*jerk*jerk_time*jerk_time*jerk_time + 0.5*initial_acceleration*jerk_time*jerk_time + initial_velocity*jerk_time;
-  velocity_end_of_jerk_time = 0.5*jerk*jerk_time*jerk_time + initial_acceleration*jerk_time + initial_velocity;
+// Only the initial-state terms; each primitive adds its own 0.1666*a*jerk_time^2 and 0.5*a*jerk_time
+void TrajectoryInitialState::updateEndOfJerkTime() {
+  position_end_of_jerk_time = (0.5 - 0.1666)*initial_acceleration*jerk_time*jerk_time + initial_velocity*jerk_time;
+  velocity_end_of_jerk_time = 0.5*initial_acceleration*jerk_time + initial_velocity;
 };
 
-void Trajectory::setInitialVelocity(Vector3 const& initial_velocity_to_set) {
-  initial_velocity = initial_velocity_to_set;
+Vector3 TrajectoryInitialState::getInitialAcceleration() const {
+  return initial_acceleration;
 };
 
-
-Vector3 Trajectory::getAcceleration() const{
-  return this->acceleration;
-}
-
-Vector3 Trajectory::getInitialVelocity() const {
+Vector3 TrajectoryInitialState::getInitialVelocity() const {
   return initial_velocity;
 };
 
-Vector3 Trajectory::getVelocity(Scalar const& t) const {
-  if (t < jerk_time) {
-    return 0.5*jerk*t*t + initial_acceleration*t + initial_velocity; 
-  }
-  else {
-    double t_left = t - jerk_time;
-    return velocity_end_of_jerk_time + acceleration*t_left;
-  }
-};
-
-Vector3 Trajectory::getPosition(Scalar const& t) const {
-  if (t < jerk_time) {
-    return 0.1666*jerk*t*t*t + 0.5*initial_acceleration*t*t + initial_velocity*t;
-  }
-  else {
-    double t_left = t - jerk_time;
-    return position_end_of_jerk_time + 0.5*acceleration*t_left*t_left + initial_velocity*t_left;
-  }
-};
-
-Vector3 Trajectory::getTerminalStopPosition(Scalar const& t) const {
-  Vector3 position_end_of_trajectory = getPosition(t);
-  Vector3 velocity_end_of_trajectory = getVelocity(t);
-
-  double speed = velocity_end_of_trajectory.norm();
-  
-  Vector3 stopping_vector = -velocity_end_of_trajectory/speed;
-  Vector3 max_stop_acceleration = a_max_horizontal*stopping_vector;
-  Vector3 stopping_jerk = (max_stop_acceleration - acceleration) / jerk_time;
-  Vector3 position_end_of_jerk_stop = 0.1666*stopping_jerk*jerk_time*jerk_time*jerk_time + 0.5*acceleration*jerk_time*jerk_time + velocity_end_of_trajectory*jerk_time + position_end_of_trajectory;
-  Vector3 velocity_end_of_jerk_stop = 0.5*stopping_jerk*jerk_time*jerk_time + acceleration*jerk_time + velocity_end_of_trajectory;
-
-  // check if stopped during jerk time
-  if (velocity_end_of_trajectory.dot(velocity_end_of_jerk_stop) < 0) {
-    return position_end_of_jerk_stop;
-  }
-
-  double realistic_stop_accel = a_max_horizontal*0.65;
-  double speed_after_jerk = velocity_end_of_jerk_stop.norm();
-  double stop_t_after_jerk = (speed_after_jerk / realistic_stop_accel);
-  //double extra_drift = speed_after_jerk*0.200;
-  double stopping_distance_after_jerk =  0.5 * -realistic_stop_accel * stop_t_after_jerk*stop_t_after_jerk + speed_after_jerk*stop_t_after_jerk;
-
-  return position_end_of_jerk_stop + stopping_distance_after_jerk*-stopping_vector;
-
-}
-
-
-void Trajectory::setAccelerationLASER(Vector3 const& acceleration_laser) {
-  this->acceleration_laser = acceleration_laser;
-};
-
-void Trajectory::setInitialAccelerationLASER(Vector3 const& initial_acceleration_laser) {
-  this->initial_acceleration_laser = initial_acceleration_laser;
-  jerk_laser = (acceleration_laser - initial_acceleration_laser) / jerk_time;
-  position_end_of_jerk_time_laser = 0.1666*jerk_laser*jerk_time*jerk_time*jerk_time + 0.5*initial_acceleration_laser*jerk_time*jerk_time + initial_velocity_laser*jerk_time;
-  velocity_end_of_jerk_time_laser = 0.5*jerk_laser*jerk_time*jerk_time + initial_acceleration_laser*jerk_time + initial_velocity_laser;
-};
-
-void Trajectory::setInitialVelocityLASER(Vector3 const& initial_velocity_laser) {
-  this->initial_velocity_laser = initial_velocity_laser;
+Vector3 TrajectoryInitialState::getPositionEndOfJerkTime() const {
+  return position_end_of_jerk_time;
 };
 
-Vector3 Trajectory::getAccelerationLASER() const{
-  return acceleration_laser;
+Vector3 TrajectoryInitialState::getVelocityEndOfJerkTime() const {
+  return velocity_end_of_jerk_time;
 };
 
-Vector3 Trajectory::getInitialVelocityLASER() const {
-  return initial_velocity_laser;
+Scalar TrajectoryInitialState::getJerkTime() const {
+  return jerk_time;
 };
 
-Vector3 Trajectory::getVelocityLASER(Scalar const& t) const {
-  if (t < jerk_time) {
-    return 0.5*jerk_laser*t*t + initial_acceleration_laser*t + initial_velocity_laser; 
-  }
-  else {
-    double t_left = t - jerk_time;
-    return velocity_end_of_jerk_time_laser + acceleration_laser*t_left;
-  }
+void Trajectory::setAccelerationMax(Scalar const& acceleration_max) {
+  this->a_max_horizontal = acceleration_max;
 };
 
-Vector3 Trajectory::getPositionLASER(Scalar const& t) const {
-  if (t < jerk_time) {
-    return 0.1666*jerk_laser*t*t*t + 0.5*initial_acceleration_laser*t*t + initial_velocity_laser*t;
-  }
-  else {
-    double t_left = t - jerk_time;
-    return position_end_of_jerk_time_laser + 0.5*acceleration_laser*t_left*t_left + initial_velocity_laser*t_left;
-  }
+void Trajectory::setAcceleration(Vector3 const& acceleration) {
+  this->acceleration = acceleration;
 };
 
-Vector3 Trajectory::getTerminalStopPositionLASER(Scalar const& t) const {
-  Vector3 position_end_of_trajectory = getPositionLASER(t);
-  Vector3 velocity_end_of_trajectory = getVelocityLASER(t);
-
-  double speed = velocity_end_of_trajectory.norm();
-  
-  Vector3 stopping_vector = -velocity_end_of_trajectory/speed;
-  Vector3 max_stop_acceleration = a_max_horizontal*stopping_vector;
-  Vector3 stopping_jerk = (max_stop_acceleration - acceleration) / jerk_time;
-  Vector3 position_end_of_jerk_stop = 0.1666*stopping_jerk*jerk_time*jerk_time*jerk_time + 0.5*acceleration*jerk_time*jerk_time + velocity_end_of_trajectory*jerk_time + position_end_of_trajectory;
-  Vector3 velocity_end_of_jerk_stop = 0.5*stopping_jerk*jerk_time*jerk_time + acceleration*jerk_time + velocity_end_of_trajectory;
-
-  // check if stopped during jerk time
-  if (velocity_end_of_trajectory.dot(velocity_end_of_jerk_stop) < 0) {
-    return position_end_of_jerk_stop;
-  }
-
-  double realistic_stop_accel = a_max_horizontal*0.65;
-  double speed_after_jerk = velocity_end_of_jerk_stop.norm();
-  double stop_t_after_jerk = (speed_after_jerk / realistic_stop_accel);
-  //double extra_drift = speed_after_jerk*0.200;
-  double stopping_distance_after_jerk =  0.5 * -realistic_stop_accel * stop_t_after_jerk*stop_t_after_jerk + speed_after_jerk*stop_t_after_jerk;
-
-  return position_end_of_jerk_stop + stopping_distance_after_jerk*-stopping_vector;
-
+Vector3 Trajectory::getAcceleration() const{
+  return this->acceleration;
 }
 
-void Trajectory::setAccelerationRDF(Vector3 const& acceleration_rdf) {
-  this->acceleration_rdf = acceleration_rdf;
-};
-
-void Trajectory::setInitialAccelerationRDF(Vector3 const& initial_acceleration_rdf) {
-  this->initial_acceleration_rdf = initial_acceleration_rdf;
-  jerk_rdf = (acceleration_rdf - initial_acceleration_rdf) / jerk_time;
-  position_end_of_jerk_time_rdf = 0.1666*jerk_rdf*jerk_time*jerk_time*jerk_time + 0.5*initial_acceleration_rdf*jerk_time*jerk_time + initial_velocity_rdf*jerk_time;
-  velocity_end_of_jerk_time_rdf = 0.5*jerk_rdf*jerk_time*jerk_time + initial_acceleration_rdf*jerk_time + initial_velocity_rdf;
-};
-
-void Trajectory::setInitialVelocityRDF(Vector3 const& initial_velocity_rdf) {
-  this->initial_velocity_rdf = initial_velocity_rdf;
-};
-
-Vector3 Trajectory::getAccelerationRDF() const{
-  return acceleration_rdf;
-};
-
-Vector3 Trajectory::getInitialVelocityRDF() const {
-  return initial_velocity_rdf;
+Vector3 Trajectory::getInitialVelocity() const {
+  return initial_state->getInitialVelocity();
 };
 
-Vector3 Trajectory::getVelocityRDF(Scalar const& t) const {
+Vector3 Trajectory::getVelocity(Scalar const& t) const {
+  Scalar jerk_time = initial_state->getJerkTime();
+  Vector3 initial_acceleration = initial_state->getInitialAcceleration();
   if (t < jerk_time) {
-    return 0.5*jerk_rdf*t*t + initial_acceleration_rdf*t + initial_velocity_rdf; 
+    Vector3 jerk = (acceleration - initial_acceleration) / jerk_time;
+    return 0.5*jerk*t*t + initial_acceleration*t + initial_state->getInitialVelocity(); 
   }
   else {
-    double t_left = t - jerk_time;
-    return velocity_end_of_jerk_time_rdf + acceleration_rdf*t_left;
+    Scalar t_left = t - jerk_time;
+    return 0.5*acceleration*jerk_time + initial_state->getVelocityEndOfJerkTime() + acceleration*t_left;
   }
 };
 
-Vector3 Trajectory::getPositionRDF(Scalar const& t) const {
+Vector3 Trajectory::getPosition(Scalar const& t) const {
+  Scalar jerk_time = initial_state->getJerkTime();
+  Vector3 initial_acceleration = initial_state->getInitialAcceleration();
+  Vector3 initial_velocity = initial_state->getInitialVelocity();
   if (t < jerk_time) {
-    return 0.1666*jerk_rdf*t*t*t + 0.5*initial_acceleration_rdf*t*t + initial_velocity_rdf*t;
+    Vector3 jerk = (acceleration - initial_acceleration) / jerk_time;
+    return 0.1666*jerk*t*t*t + 0.5*initial_acceleration*t*t + initial_velocity*t;
   }
   else {
-    double t_left = t - jerk_time;
-    return position_end_of_jerk_time_rdf + 0.5*acceleration_rdf*t_left*t_left + initial_velocity_rdf*t_left;
+    Scalar t_left = t - jerk_time;
+    return 0.1666*acceleration*jerk_time*jerk_time + initial_state->getPositionEndOfJerkTime() + 0.5*acceleration*t_left*t_left + initial_velocity*t_left;
   }
 };
 
-Vector3 Trajectory::getTerminalStopPositionRDF(Scalar const& t) const {
-  Vector3 position_end_of_trajectory = getPositionRDF(t);
-  Vector3 velocity_end_of_trajectory = getVelocityRDF(t);
+Vector3 Trajectory::getTerminalStopPosition(Scalar const& t) const {
+  Scalar jerk_time = initial_state->getJerkTime();
+  Vector3 position_end_of_trajectory = getPosition(t);
+  Vector3 velocity_end_of_trajectory = getVelocity(t);
 
-  double speed = velocity_end_of_trajectory.norm();
+  Scalar speed = velocity_end_of_trajectory.norm();
   
   Vector3 stopping_vector = -velocity_end_of_trajectory/speed;
   Vector3 max_stop_acceleration = a_max_horizontal*stopping_vector;
@@ -206,16 +97,12 @@ Vector3 Trajectory::getTerminalStopPositionRDF(Scalar const& t) const {
     return position_end_of_jerk_stop;
   }
 
-  double realistic_stop_accel = a_max_horizontal*0.65;
-  double speed_after_jerk = velocity_end_of_jerk_stop.norm();
-  double stop_t_after_jerk = (speed_after_jerk / realistic_stop_accel);
+  Scalar realistic_stop_accel = a_max_horizontal*0.65;
+  Scalar speed_after_jerk = velocity_end_of_jerk_stop.norm();
+  Scalar stop_t_after_jerk = (speed_after_jerk / realistic_stop_accel);
   //double extra_drift = speed_after_jerk*0.200;
-  double stopping_distance_after_jerk =  0.5 * -realistic_stop_accel * stop_t_after_jerk*stop_t_after_jerk + speed_after_jerk*stop_t_after_jerk;
+  Scalar stopping_distance_after_jerk =  0.5 * -realistic_stop_accel * stop_t_after_jerk*stop_t_after_jerk + speed_after_jerk*stop_t_after_jerk;
 
   return position_end_of_jerk_stop + stopping_distance_after_jerk*-stopping_vector;
 
 }
-
-
-
-
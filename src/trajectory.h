@@ -2,30 +2,60 @@
 #define TRAJECTORY_H
 
 #include <iostream>
+#include <memory>
 #include <Eigen/Dense>
 
+// Build with -DTRAJECTORY_SELECTOR_USE_FLOAT to evaluate the whole pipeline in single precision
+#ifdef TRAJECTORY_SELECTOR_USE_FLOAT
+typedef float Scalar;
+#else
 typedef double Scalar;
+#endif
 typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
 typedef Eigen::Matrix<Scalar, 3, 3> Matrix3;
 typedef Eigen::Matrix<Scalar, 1, 1> Vector1;
 
+// Initial state shared by every primitive of a library.
+// The state-dependent parts of the end-of-jerk-time terms are computed here once per update.
+class TrajectoryInitialState {
+public:
+
+  void setInitialAcceleration(Vector3 const& initial_acceleration);
+  void setInitialVelocity(Vector3 const& initial_velocity);
+
+  Vector3 getInitialAcceleration() const;
+  Vector3 getInitialVelocity() const;
+  Vector3 getPositionEndOfJerkTime() const;
+  Vector3 getVelocityEndOfJerkTime() const;
+  Scalar getJerkTime() const;
+
+private:
+
+  void updateEndOfJerkTime();
+
+  Vector3 initial_velocity = Vector3(0,0,0);
+  Vector3 initial_acceleration = Vector3(0,0,0);
+  Vector3 position_end_of_jerk_time = Vector3(0,0,0);
+  Vector3 velocity_end_of_jerk_time = Vector3(0,0,0);
+
+  Scalar jerk_time = 0.200;
+
+};
+
 class Trajectory {
 public:
  
   Trajectory(){};
 
-  Trajectory(Vector3 acceleration, Vector3 initial_velocity) {
+  Trajectory(Vector3 acceleration, std::shared_ptr<TrajectoryInitialState const> const& initial_state) {
   	this->acceleration = acceleration;
-  	this->initial_velocity = initial_velocity; 
-  	std::cout << "I'm initializing trajecotories " << std::endl;
+  	this->initial_state = initial_state;
   };
 
 
-  void setAccelerationMax(double const& acceleration_max);
+  void setAccelerationMax(Scalar const& acceleration_max);
 
   void setAcceleration(Vector3 const& acceleration);
-  void setInitialAcceleration(Vector3 const& initial_acceleration);
-  void setInitialVelocity(Vector3 const& initial_velocity);
   
   Vector3 getAcceleration() const;
   Vector3 getVelocity(Scalar const& t) const;
@@ -33,54 +63,14 @@ public:
   Vector3 getPosition(Scalar const& t) const;
   Vector3 getTerminalStopPosition(Scalar const& t) const;
 
-  void setAccelerationLASER(Vector3 const& acceleration_laser);
-  void setInitialAccelerationLASER(Vector3 const& initial_acceleration_laser);
-  void setInitialVelocityLASER(Vector3 const& initial_velocity_laser);
-
-  Vector3 getAccelerationLASER() const;
-  Vector3 getVelocityLASER(Scalar const& t) const;
-  Vector3 getInitialVelocityLASER() const;
-  Vector3 getPositionLASER(Scalar const& t) const;
-  Vector3 getTerminalStopPositionLASER(Scalar const& t) const;
-
-  void setAccelerationRDF(Vector3 const& acceleration_rdf);
-  void setInitialAccelerationRDF(Vector3 const& initial_acceleration_rdf);
-  void setInitialVelocityRDF(Vector3 const& initial_velocity_rdf);
-
-  Vector3 getAccelerationRDF() const;
-  Vector3 getVelocityRDF(Scalar const& t) const;
-  Vector3 getInitialVelocityRDF() const;
-  Vector3 getPositionRDF(Scalar const& t) const;
-  Vector3 getTerminalStopPositionRDF(Scalar const& t) const;
-  
-
 
 
 private:
   
   Vector3 acceleration;
-  Vector3 initial_velocity;
-  Vector3 initial_acceleration;
-  Vector3 jerk;
-  Vector3 position_end_of_jerk_time;
-  Vector3 velocity_end_of_jerk_time;
-
-  Vector3 acceleration_laser;
-  Vector3 initial_velocity_laser;
-  Vector3 initial_acceleration_laser;
-  Vector3 jerk_laser;
-  Vector3 position_end_of_jerk_time_laser;
-  Vector3 velocity_end_of_jerk_time_laser;
-
-  Vector3 acceleration_rdf;
-  Vector3 initial_velocity_rdf;
-  Vector3 initial_acceleration_rdf;
-  Vector3 jerk_rdf;
-  Vector3 position_end_of_jerk_time_rdf;
-  Vector3 velocity_end_of_jerk_time_rdf;
-
-  double a_max_horizontal;
-  double jerk_time = 0.200;
+  std::shared_ptr<TrajectoryInitialState const> initial_state;
+
+  Scalar a_max_horizontal;
 
 };
 
@@ -0,0 +1,291 @@
+#include "trajectory_batch.h"
+
+void TrajectoryBasis::Build(Eigen::Ref<const VectorX> const& sampling_time_vector, Scalar const& jerk_time) {
+  Build(sampling_time_vector, jerk_time, std::vector<Scalar>(1, 1.0));
+};
+
+void TrajectoryBasis::Build(Eigen::Ref<const VectorX> const& sampling_time_vector, Scalar const& jerk_time, std::vector<Scalar> const& horizon_scales) {
+  this->jerk_time = jerk_time;
+  size_t num_samples = sampling_time_vector.size();
+  position_basis.resize(horizon_scales.size());
+  velocity_basis.resize(horizon_scales.size());
+
+  // Same piecewise polynomial as Trajectory::getPosition / getVelocity, with jerk = (acceleration - initial_acceleration) / jerk_time expanded
+  Scalar jt = jerk_time;
+  for (size_t horizon = 0; horizon < horizon_scales.size(); horizon++) {
+    position_basis[horizon].resize(num_samples, 3);
+    velocity_basis[horizon].resize(num_samples, 3);
+    for (size_t time_index = 0; time_index < num_samples; time_index++) {
+      Scalar t = horizon_scales[horizon]*sampling_time_vector(time_index);
+      if (t < jt) {
+        position_basis[horizon].row(time_index) << 0.1666*t*t*t/jt, 0.5*t*t - 0.1666*t*t*t/jt, t;
+        velocity_basis[horizon].row(time_index) << 0.5*t*t/jt, t - 0.5*t*t/jt, 1.0;
+      }
+      else {
+        Scalar t_left = t - jt;
+        position_basis[horizon].row(time_index) << 0.1666*jt*jt + 0.5*t_left*t_left, 0.5*jt*jt - 0.1666*jt*jt, jt + t_left;
+        velocity_basis[horizon].row(time_index) << 0.5*jt + t_left, 0.5*jt, 1.0;
+      }
+    }
+  }
+};
+
+void TrajectoryBatch::resize(size_t num_trajectories) {
+  acceleration = Eigen::Matrix<Scalar, Eigen::Dynamic, 3>::Zero(num_trajectories, 3);
+  setHorizons(std::vector<size_t>(1, num_trajectories), std::vector<Scalar>(1, 1.0));
+  terminal_stop_table.clear();
+};
+
+void TrajectoryBatch::setHorizons(std::vector<size_t> const& horizon_sizes, std::vector<Scalar> const& horizon_scales) {
+  this->horizon_scales = horizon_scales;
+  horizon_offsets.assign(1, 0);
+  for (size_t horizon = 0; horizon < horizon_sizes.size(); horizon++) {
+    horizon_offsets.push_back(horizon_offsets.back() + horizon_sizes[horizon]);
+  }
+};
+
+std::vector<Scalar> const& TrajectoryBatch::getHorizonScales() const {
+  return horizon_scales;
+};
+
+Scalar TrajectoryBatch::getHorizonScale(size_t index) const {
+  size_t horizon = 0;
+  while (index >= horizon_offsets[horizon+1]) {
+    horizon++;
+  }
+  return horizon_scales[horizon];
+};
+
+size_t TrajectoryBatch::getNumTrajectories() const {
+  return acceleration.rows();
+};
+
+void TrajectoryBatch::setAccelerationMax(Scalar const& acceleration_max) {
+  this->a_max_horizontal = acceleration_max;
+};
+
+Scalar TrajectoryBatch::getAccelerationMax() const {
+  return a_max_horizontal;
+};
+
+void TrajectoryBatch::setAcceleration(size_t index, Vector3 const& acceleration) {
+  this->acceleration.row(index) = acceleration.transpose();
+};
+
+void TrajectoryBatch::setInitialState(std::shared_ptr<TrajectoryInitialState const> const& initial_state) {
+  this->initial_state = initial_state;
+};
+
+Vector3 TrajectoryBatch::getAcceleration(size_t index) const {
+  return acceleration.row(index).transpose();
+};
+
+Vector3 TrajectoryBatch::getInitialAcceleration() const {
+  return initial_state->getInitialAcceleration();
+};
+
+Scalar TrajectoryBatch::getJerkTime() const {
+  return initial_state->getJerkTime();
+};
+
+// Per horizon block, samples.axis[k] = acceleration.col(k) * basis.col(0)^T + 1 * (basis.rightCols(2) * [initial_acceleration initial_velocity]^T).col(k)^T
+void TrajectoryBatch::ApplyBasis(std::vector<Eigen::Matrix<Scalar, Eigen::Dynamic, 3> > const& basis, Eigen::Matrix<Scalar, 2, 3> const& initial_state, TrajectorySamples* samples) const {
+  samples->resize(acceleration.rows(), basis.front().rows());
+  for (size_t horizon = 0; horizon < horizon_scales.size(); horizon++) {
+    size_t offset = horizon_offsets[horizon];
+    size_t count = horizon_offsets[horizon+1] - offset;
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 3> shared = basis[horizon].rightCols<2>() * initial_state;
+    for (int k = 0; k < 3; k++) {
+      samples->axis[k].middleRows(offset, count).matrix().noalias() = acceleration.col(k).segment(offset, count) * basis[horizon].col(0).transpose();
+      samples->axis[k].middleRows(offset, count).rowwise() += shared.col(k).transpose().array();
+    }
+  }
+};
+
+void TrajectoryBatch::Sample(TrajectoryBasis const& basis, TrajectorySamples* positions, TrajectorySamples* velocities) const {
+  Eigen::Matrix<Scalar, 2, 3> initial_state;
+  initial_state.row(0) = this->initial_state->getInitialAcceleration().transpose();
+  initial_state.row(1) = this->initial_state->getInitialVelocity().transpose();
+
+  if (positions != nullptr) {
+    ApplyBasis(basis.position_basis, initial_state, positions);
+  }
+  if (velocities != nullptr) {
+    ApplyBasis(basis.velocity_basis, initial_state, velocities);
+  }
+};
+
+void TrajectoryBatch::Sample(Eigen::Ref<const VectorX> const& sampling_time_vector, TrajectorySamples* positions, TrajectorySamples* velocities) const {
+  Sample(TrajectoryBasis(sampling_time_vector, getJerkTime(), horizon_scales), positions, velocities);
+};
+
+// Vectorized Trajectory::getTerminalStopPosition for every primitive, at t scaled by each primitive's horizon
+void TrajectoryBatch::SampleTerminalStopPositions(Scalar const& t, ArrayX3 &terminal_stop_positions) const {
+  size_t num_trajectories = getNumTrajectories();
+  VectorX final_time_vector(1);
+  final_time_vector << t;
+  TrajectorySamples position_end_of_trajectory;
+  TrajectorySamples velocity_end_of_trajectory;
+  Sample(final_time_vector, &position_end_of_trajectory, &velocity_end_of_trajectory);
+
+  ArrayX3 velocity(num_trajectories, 3);
+  terminal_stop_positions.resize(num_trajectories, 3);
+  for (int k = 0; k < 3; k++) {
+    velocity.col(k) = velocity_end_of_trajectory.axis[k].col(0);
+    terminal_stop_positions.col(k) = position_end_of_trajectory.axis[k].col(0);
+  }
+
+  if (!terminal_stop_table.isBuilt()) {
+    ArrayX3 stop_offsets;
+    ComputeStopOffsets(velocity, acceleration.array(), stop_offsets);
+    terminal_stop_positions += stop_offsets;
+    return;
+  }
+
+  std::vector<size_t> exact_indices;
+  terminal_stop_table.Lookup(velocity, terminal_stop_positions, exact_indices);
+  if (exact_indices.empty()) {
+    return;
+  }
+
+  ArrayX3 exact_velocity(exact_indices.size(), 3);
+  ArrayX3 exact_acceleration(exact_indices.size(), 3);
+  for (size_t j = 0; j < exact_indices.size(); j++) {
+    exact_velocity.row(j) = velocity.row(exact_indices[j]);
+    exact_acceleration.row(j) = acceleration.row(exact_indices[j]).array();
+  }
+  ArrayX3 exact_stop_offsets;
+  ComputeStopOffsets(exact_velocity, exact_acceleration, exact_stop_offsets);
+  for (size_t j = 0; j < exact_indices.size(); j++) {
+    terminal_stop_positions.row(exact_indices[j]) += exact_stop_offsets.row(j);
+  }
+};
+
+void TrajectoryBatch::ComputeStopOffsets(ArrayX3 const& velocity, ArrayX3 const& primitive_acceleration, ArrayX3 &stop_offsets) const {
+  size_t num_rows = velocity.rows();
+  Scalar jt = getJerkTime();
+  ArrayX speed = velocity.square().rowwise().sum().sqrt();
+
+  ArrayX3 stopping_vector(num_rows, 3);
+  ArrayX3 offset_end_of_jerk_stop(num_rows, 3);
+  ArrayX3 velocity_end_of_jerk_stop(num_rows, 3);
+  for (int k = 0; k < 3; k++) {
+    stopping_vector.col(k) = -velocity.col(k) / speed;
+    ArrayX stopping_jerk = (a_max_horizontal*stopping_vector.col(k) - primitive_acceleration.col(k)) / jt;
+    offset_end_of_jerk_stop.col(k) = 0.1666*jt*jt*jt*stopping_jerk + 0.5*jt*jt*primitive_acceleration.col(k) + jt*velocity.col(k);
+    velocity_end_of_jerk_stop.col(k) = 0.5*jt*jt*stopping_jerk + jt*primitive_acceleration.col(k) + velocity.col(k);
+  }
+
+  ArrayX velocity_dot = (velocity*velocity_end_of_jerk_stop).rowwise().sum();
+
+  Scalar realistic_stop_accel = a_max_horizontal*0.65;
+  ArrayX speed_after_jerk = velocity_end_of_jerk_stop.square().rowwise().sum().sqrt();
+  ArrayX stop_t_after_jerk = speed_after_jerk / realistic_stop_accel;
+  ArrayX stopping_distance_after_jerk = 0.5 * -realistic_stop_accel * stop_t_after_jerk.square() + speed_after_jerk*stop_t_after_jerk;
+
+  stop_offsets.resize(num_rows, 3);
+  for (int k = 0; k < 3; k++) {
+    // stopped during jerk time if the velocity flipped
+    stop_offsets.col(k) = (velocity_dot < 0).select(offset_end_of_jerk_stop.col(k),
+                            offset_end_of_jerk_stop.col(k) - stopping_distance_after_jerk*stopping_vector.col(k));
+  }
+};
+
+void TrajectoryBatch::BuildTerminalStopTable(Scalar const& max_speed, size_t const& num_bins, Scalar const& tolerance) {
+  terminal_stop_table.Build(*this, max_speed, num_bins, tolerance);
+};
+
+void TrajectoryBatch::ClearTerminalStopTable() {
+  terminal_stop_table.clear();
+};
+
+void TerminalStopTable::Build(TrajectoryBatch const& batch, Scalar const& max_speed, size_t const& num_bins, Scalar const& tolerance) {
+  size_t num_trajectories = batch.getNumTrajectories();
+  size_t num_nodes = num_bins + 1;
+  Scalar bin_size = 2*max_speed/num_bins;
+  this->max_speed = max_speed;
+  this->inverse_bin_size = 1/bin_size;
+  this->tolerance = tolerance;
+  this->num_bins = 0;
+
+  ArrayX3 primitive_acceleration(num_trajectories, 3);
+  for (size_t i = 0; i < num_trajectories; i++) {
+    primitive_acceleration.row(i) = batch.getAcceleration(i).transpose().array();
+  }
+
+  // Grid nodes, one batch-wide evaluation per node
+  ArrayX3 velocity(num_trajectories, 3);
+  ArrayX3 node_offsets;
+  stop_offsets.resize(3*num_nodes*num_nodes, num_trajectories);
+  for (size_t iy = 0; iy < num_nodes; iy++) {
+    for (size_t ix = 0; ix < num_nodes; ix++) {
+      velocity.col(0).setConstant(-max_speed + ix*bin_size);
+      velocity.col(1).setConstant(-max_speed + iy*bin_size);
+      velocity.col(2).setZero();
+      batch.ComputeStopOffsets(velocity, primitive_acceleration, node_offsets);
+      stop_offsets.middleRows(3*(iy*num_nodes + ix), 3) = node_offsets.transpose();
+    }
+  }
+  this->num_bins = num_bins;
+
+  // Worst error on a 4x4 interior subgrid of each cell
+  size_t num_checks = 4;
+  ArrayX3 exact_offsets;
+  Vector3 interpolated_offset;
+  cell_error = ArrayXX::Zero(num_bins*num_bins, num_trajectories);
+  for (size_t iy = 0; iy < num_bins; iy++) {
+    for (size_t ix = 0; ix < num_bins; ix++) {
+      for (size_t cy = 0; cy < num_checks; cy++) {
+        for (size_t cx = 0; cx < num_checks; cx++) {
+          Scalar fx = ix + (cx + 0.5)/num_checks;
+          Scalar fy = iy + (cy + 0.5)/num_checks;
+          Vector3 check_velocity(-max_speed + fx*bin_size, -max_speed + fy*bin_size, 0);
+          velocity.rowwise() = check_velocity.transpose().array();
+          batch.ComputeStopOffsets(velocity, primitive_acceleration, exact_offsets);
+          for (size_t i = 0; i < num_trajectories; i++) {
+            Interpolate(i, fx, fy, interpolated_offset);
+            Scalar error = (interpolated_offset.transpose().array() - exact_offsets.row(i)).matrix().norm();
+            // NaN near zero speed must mark the cell as unusable
+            if (!(error <= cell_error(iy*num_bins + ix, i))) {
+              cell_error(iy*num_bins + ix, i) = (error == error) ? error : std::numeric_limits<Scalar>::infinity();
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+// fx, fy are the velocity in bins from the grid's -max_speed corner
+void TerminalStopTable::Interpolate(size_t trajectory_index, Scalar const& fx, Scalar const& fy, Vector3 &stop_offset) const {
+  size_t num_nodes = num_bins + 1;
+  size_t ix = fx;
+  size_t iy = fy;
+  Scalar wx = fx - ix;
+  Scalar wy = fy - iy;
+  Scalar const* low = &stop_offsets(3*(iy*num_nodes + ix), trajectory_index);
+  Scalar const* high = low + 3*num_nodes;
+  for (int k = 0; k < 3; k++) {
+    stop_offset(k) = (1-wy)*((1-wx)*low[k] + wx*low[k + 3]) + wy*((1-wx)*high[k] + wx*high[k + 3]);
+  }
+};
+
+void TerminalStopTable::Lookup(ArrayX3 const& velocity, ArrayX3 &stop_positions, std::vector<size_t> &exact_indices) const {
+  size_t num_rows = velocity.rows();
+  ArrayX fx = (velocity.col(0) + max_speed)*inverse_bin_size;
+  ArrayX fy = (velocity.col(1) + max_speed)*inverse_bin_size;
+  Vector3 stop_offset;
+  for (size_t i = 0; i < num_rows; i++) {
+    if (velocity(i, 2) != 0 || !(fx(i) >= 0 && fx(i) < num_bins && fy(i) >= 0 && fy(i) < num_bins)) {
+      exact_indices.push_back(i);
+      continue;
+    }
+    size_t cell = size_t(fy(i))*num_bins + size_t(fx(i));
+    if (!(cell_error(cell, i) <= tolerance)) {
+      exact_indices.push_back(i);
+      continue;
+    }
+    Interpolate(i, fx(i), fy(i), stop_offset);
+    stop_positions.row(i) += stop_offset.transpose().array();
+  }
+};
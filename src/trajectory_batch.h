@@ -0,0 +1,180 @@
+#ifndef TRAJECTORY_BATCH_H
+#define TRAJECTORY_BATCH_H
+
+#include <iostream>
+#include <limits>
+#include <vector>
+#include "trajectory.h"
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> VectorX;
+typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> ArrayX;
+typedef Eigen::Array<Scalar, Eigen::Dynamic, 3> ArrayX3;
+typedef Eigen::Array<Scalar, Eigen::Dynamic, Eigen::Dynamic> ArrayXX;
+
+// N x T x 3 buffer, one N x T plane per axis.
+// Column t of a plane holds that axis for every primitive at sample time t, contiguously.
+struct TrajectorySamples {
+
+  void resize(size_t num_trajectories, size_t num_samples) {
+    for (int k = 0; k < 3; k++) {
+      axis[k].resize(num_trajectories, num_samples);
+    }
+  };
+
+  size_t getNumTrajectories() const {
+    return axis[0].rows();
+  };
+
+  size_t getNumSamples() const {
+    return axis[0].cols();
+  };
+
+  Vector3 getSample(size_t trajectory_index, size_t time_index) const {
+    return Vector3(axis[0](trajectory_index, time_index), axis[1](trajectory_index, time_index), axis[2](trajectory_index, time_index));
+  };
+
+  // Applies x -> rotation*x + translation to every sample in place
+  void Transform(Matrix3 const& rotation, Vector3 const& translation) {
+    for (int k = 0; k < 3; k++) {
+      transformed[k] = rotation(k,0)*axis[0] + rotation(k,1)*axis[1] + rotation(k,2)*axis[2] + translation(k);
+    }
+    for (int k = 0; k < 3; k++) {
+      axis[k].swap(transformed[k]);
+    }
+  };
+
+  void Translate(Vector3 const& translation) {
+    for (int k = 0; k < 3; k++) {
+      axis[k] += translation(k);
+    }
+  };
+
+  ArrayXX axis[3];
+
+private:
+  ArrayXX transformed[3];
+};
+
+// Closed-form coefficients of every primitive at each sampling time.
+// Per axis, x(t_i) = basis(i,0)*acceleration + basis(i,1)*initial_acceleration + basis(i,2)*initial_velocity,
+// so only needs rebuilding when the sampling times or the jerk time change.
+// Multi-horizon libraries get one coefficient block per horizon, with the sampling times scaled by that horizon.
+class TrajectoryBasis {
+public:
+
+  TrajectoryBasis() {};
+  TrajectoryBasis(Eigen::Ref<const VectorX> const& sampling_time_vector, Scalar const& jerk_time, std::vector<Scalar> const& horizon_scales) {
+    Build(sampling_time_vector, jerk_time, horizon_scales);
+  };
+
+  void Build(Eigen::Ref<const VectorX> const& sampling_time_vector, Scalar const& jerk_time);
+  void Build(Eigen::Ref<const VectorX> const& sampling_time_vector, Scalar const& jerk_time, std::vector<Scalar> const& horizon_scales);
+
+  size_t getNumSamples() const {
+    return position_basis.front().rows();
+  };
+
+  size_t getNumHorizons() const {
+    return position_basis.size();
+  };
+
+  Scalar getJerkTime() const {
+    return jerk_time;
+  };
+
+  std::vector<Eigen::Matrix<Scalar, Eigen::Dynamic, 3> > position_basis;
+  std::vector<Eigen::Matrix<Scalar, Eigen::Dynamic, 3> > velocity_basis;
+
+private:
+  Scalar jerk_time = 0;
+};
+
+class TrajectoryBatch;
+
+// Terminal stop offsets (stop position minus end-of-trajectory position) of every primitive, tabulated
+// over a grid of horizontal end-of-trajectory velocities and bilinearly interpolated.
+// Each cell records its worst interpolation error over an interior subgrid, and cells above
+// tolerance, velocities off the grid and non-zero vertical velocities fall back to the exact offset.
+// Only planar libraries build one: their end velocities have no vertical component.
+class TerminalStopTable {
+public:
+
+  void Build(TrajectoryBatch const& batch, Scalar const& max_speed, size_t const& num_bins, Scalar const& tolerance);
+  void clear() {
+    num_bins = 0;
+  };
+  bool isBuilt() const {
+    return num_bins > 0;
+  };
+
+  // Adds the interpolated offset to each row of stop_positions the table covers, and lists the other rows,
+  // which need the exact offset, in exact_indices
+  void Lookup(ArrayX3 const& velocity, ArrayX3 &stop_positions, std::vector<size_t> &exact_indices) const;
+
+private:
+
+  void Interpolate(size_t trajectory_index, Scalar const& fx, Scalar const& fy, Vector3 &stop_offset) const;
+
+  Scalar max_speed = 0;
+  Scalar inverse_bin_size = 0;
+  Scalar tolerance = 0;
+  size_t num_bins = 0;
+
+  // 3(num_bins+1)^2 x N, one column per primitive; axis k of grid node (ix, iy) in row 3*(iy*(num_bins+1) + ix) + k,
+  // so the four nodes around a velocity are two runs of six
+  ArrayXX stop_offsets;
+  // num_bins^2 x N, cell (ix, iy) in row iy*num_bins + ix
+  ArrayXX cell_error;
+};
+
+// Structure-of-arrays copy of every primitive in a library, reading the library's shared initial state.
+class TrajectoryBatch {
+public:
+
+  void resize(size_t num_trajectories);
+  size_t getNumTrajectories() const;
+
+  void setAccelerationMax(Scalar const& acceleration_max);
+  Scalar getAccelerationMax() const;
+  void setAcceleration(size_t index, Vector3 const& acceleration);
+  void setInitialState(std::shared_ptr<TrajectoryInitialState const> const& initial_state);
+
+  // Primitives are stored grouped by horizon; horizon_sizes[h] consecutive primitives run for horizon_scales[h] of the reference final_time
+  void setHorizons(std::vector<size_t> const& horizon_sizes, std::vector<Scalar> const& horizon_scales);
+  std::vector<Scalar> const& getHorizonScales() const;
+  Scalar getHorizonScale(size_t index) const;
+
+  Vector3 getAcceleration(size_t index) const;
+  Vector3 getInitialAcceleration() const;
+  Scalar getJerkTime() const;
+
+  // Fills positions and/or velocities (either may be nullptr) for every primitive at every sampling time
+  void Sample(TrajectoryBasis const& basis, TrajectorySamples* positions, TrajectorySamples* velocities) const;
+  void Sample(Eigen::Ref<const VectorX> const& sampling_time_vector, TrajectorySamples* positions, TrajectorySamples* velocities) const;
+  void SampleTerminalStopPositions(Scalar const& t, ArrayX3 &terminal_stop_positions) const;
+
+  // Nonlinear part of Trajectory::getTerminalStopPosition, per row of end-of-trajectory velocity and primitive acceleration
+  void ComputeStopOffsets(ArrayX3 const& velocity, ArrayX3 const& primitive_acceleration, ArrayX3 &stop_offsets) const;
+
+  // Optional lookup table for the stop offsets; only valid while the accelerations, maximum and jerk time are unchanged
+  void BuildTerminalStopTable(Scalar const& max_speed, size_t const& num_bins, Scalar const& tolerance);
+  void ClearTerminalStopTable();
+
+private:
+
+  void ApplyBasis(std::vector<Eigen::Matrix<Scalar, Eigen::Dynamic, 3> > const& basis, Eigen::Matrix<Scalar, 2, 3> const& initial_state, TrajectorySamples* samples) const;
+
+  Eigen::Matrix<Scalar, Eigen::Dynamic, 3> acceleration;
+
+  std::vector<size_t> horizon_offsets;
+  std::vector<Scalar> horizon_scales;
+
+  std::shared_ptr<TrajectoryInitialState const> initial_state = std::make_shared<TrajectoryInitialState>();
+
+  Scalar a_max_horizontal = 0;
+
+  TerminalStopTable terminal_stop_table;
+
+};
+
+#endif
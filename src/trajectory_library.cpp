@@ -3,67 +3,160 @@
 #include <math.h>
 
 void TrajectoryLibrary::Initialize2DLibrary(double const& final_time) {
+	Initialize2DLibrary(final_time, 8, {1.0, 0.6, 0.15});
+};
+
+void TrajectoryLibrary::Initialize2DLibrary(double const& final_time, size_t const& num_directions, std::vector<double> const& magnitude_fractions) {
 	//double a_max_horizontal = sqrt(a_max*a_max - 9.8*9.8);
 	double a_max_horizontal = 9.8*0.50;
-	Vector3 zero_initial_velocity = Vector3(0,0,0);
+	trajectories.clear();
 
 	// Make first trajectory be zero accelerations
 	Vector3 acceleration = Vector3(0,0,0);
-	trajectories.push_back(Trajectory( acceleration, zero_initial_velocity ));
-
-	// Make next 8 trajectories sample around maximum horizontal acceleration
-	for (double i = 1; i < 9; i++) {
-		double theta = (i-1)*2*M_PI/8.0;
-		acceleration << cos(theta)*a_max_horizontal, sin(theta)*a_max_horizontal, 0;
-		trajectories.push_back(Trajectory( acceleration, zero_initial_velocity ));
+	trajectories.push_back(Trajectory( acceleration, initial_state ));
+
+	// Make one ring of num_directions trajectories per fraction of maximum horizontal acceleration
+	for (size_t ring = 0; ring < magnitude_fractions.size(); ring++) {
+		double magnitude = magnitude_fractions.at(ring)*a_max_horizontal;
+		for (size_t direction = 0; direction < num_directions; direction++) {
+			double theta = direction*2*M_PI/num_directions;
+			acceleration << cos(theta)*magnitude, sin(theta)*magnitude, 0;
+			trajectories.push_back(Trajectory( acceleration, initial_state ));
+		}
 	}
 
-	// Make next 8 trajectories sample around 0.6 * maximum horizontal acceleration
-	for (double i = 9; i < 17; i++) {
-		double theta = (i-1)*2*M_PI/8.0;
-		acceleration << cos(theta)*0.6*a_max_horizontal, sin(theta)*0.6*a_max_horizontal, 0;
-		trajectories.push_back(Trajectory( acceleration, zero_initial_velocity ));
-	}
+	this->final_time = final_time; 
+	is_planar = true;
+
+	UpdateBatch(a_max_horizontal, std::vector<size_t>(1, trajectories.size()), std::vector<Scalar>(1, 1.0));
+};
 
-	// Make next 8 trajectories sample around 0.3 * maximum horizontal acceleration
-	for (double i = 17; i < 25; i++) {
-		double theta = (i-1)*2*M_PI/8.0;
-		acceleration << cos(theta)*0.15*a_max_horizontal, sin(theta)*0.15*a_max_horizontal, 0;
-		trajectories.push_back(Trajectory( acceleration, zero_initial_velocity ));
+void TrajectoryLibrary::Initialize3DLibrary(std::vector<double> const& final_times, size_t const& num_directions, std::vector<double> const& elevation_angles, std::vector<double> const& magnitude_fractions) {
+	double a_max_horizontal = 9.8*0.50;
+	trajectories.clear();
+
+	std::vector<size_t> horizon_sizes;
+	std::vector<Scalar> horizon_scales;
+
+	// One full set per horizon, kept contiguous so the batch can sample each horizon as one block
+	for (size_t horizon = 0; horizon < final_times.size(); horizon++) {
+		size_t horizon_begin = trajectories.size();
+
+		// Zero acceleration first
+		Vector3 acceleration = Vector3(0,0,0);
+		trajectories.push_back(Trajectory( acceleration, initial_state ));
+
+		// Then one ring of num_directions trajectories per elevation angle and fraction of maximum acceleration
+		for (size_t ring = 0; ring < magnitude_fractions.size(); ring++) {
+			double magnitude = magnitude_fractions.at(ring)*a_max_horizontal;
+			for (size_t elevation = 0; elevation < elevation_angles.size(); elevation++) {
+				double phi = elevation_angles.at(elevation);
+				for (size_t direction = 0; direction < num_directions; direction++) {
+					double theta = direction*2*M_PI/num_directions;
+					acceleration << cos(phi)*cos(theta)*magnitude, cos(phi)*sin(theta)*magnitude, sin(phi)*magnitude;
+					trajectories.push_back(Trajectory( acceleration, initial_state ));
+				}
+			}
+		}
+
+		horizon_sizes.push_back(trajectories.size() - horizon_begin);
+		horizon_scales.push_back(final_times.at(horizon) / final_times.front());
 	}
 
-	this->final_time = final_time; 
+	// Horizons are expressed relative to the first one
+	this->final_time = final_times.front();
+	is_planar = false;
 
+	UpdateBatch(a_max_horizontal, horizon_sizes, horizon_scales);
+};
+
+void TrajectoryLibrary::UpdateBatch(double const& a_max_horizontal, std::vector<size_t> const& horizon_sizes, std::vector<Scalar> const& horizon_scales) {
 	for (size_t index = 0; index < trajectories.size(); index++) {
 		trajectories.at(index).setAccelerationMax(a_max_horizontal);
 	}
 
+	batch.resize(trajectories.size());
+	batch.setHorizons(horizon_sizes, horizon_scales);
+	batch.setAccelerationMax(a_max_horizontal);
+	batch.setInitialState(initial_state);
+	for (size_t index = 0; index < trajectories.size(); index++) {
+		batch.setAcceleration(index, trajectories.at(index).getAcceleration());
+	}
+};
+
+void TrajectoryLibrary::BuildTerminalStopTable(Scalar const& max_speed, size_t const& num_bins, Scalar const& tolerance) {
+	if (!is_planar) {
+		batch.ClearTerminalStopTable();
+		return;
+	}
+	batch.BuildTerminalStopTable(max_speed, num_bins, tolerance);
+};
+
+void TrajectoryLibrary::UpdateRefinementBatch(std::vector<size_t> const& seed_indices, Scalar const& radius, size_t const& num_directions) {
+	Scalar a_max_horizontal = batch.getAccelerationMax();
+	std::vector<Vector3> accelerations;
+	std::vector<size_t> horizon_sizes;
+	std::vector<Scalar> horizon_scales;
+
+	// Each seed keeps its own horizon, so each seed's set is one horizon block
+	for (size_t seed = 0; seed < seed_indices.size(); seed++) {
+		size_t seed_begin = accelerations.size();
+		Vector3 seed_acceleration = batch.getAcceleration(seed_indices.at(seed));
+		accelerations.push_back(seed_acceleration);
+
+		// Two rings of num_directions offsets, at radius and half radius
+		for (size_t ring = 1; ring <= 2; ring++) {
+			Scalar offset = radius*ring/2;
+			for (size_t direction = 0; direction < num_directions; direction++) {
+				double theta = direction*2*M_PI/num_directions;
+				accelerations.push_back(seed_acceleration + offset*Vector3(cos(theta), sin(theta), 0));
+			}
+		}
+		if (!is_planar) {
+			accelerations.push_back(seed_acceleration + Vector3(0, 0, radius));
+			accelerations.push_back(seed_acceleration - Vector3(0, 0, radius));
+		}
+
+		horizon_sizes.push_back(accelerations.size() - seed_begin);
+		horizon_scales.push_back(batch.getHorizonScale(seed_indices.at(seed)));
+	}
+
+	refinement_batch.resize(accelerations.size());
+	refinement_batch.setHorizons(horizon_sizes, horizon_scales);
+	refinement_batch.setAccelerationMax(a_max_horizontal);
+	refinement_batch.setInitialState(initial_state);
+	for (size_t index = 0; index < accelerations.size(); index++) {
+		// Stay within the coarse library's horizontal acceleration envelope; the vertical part is left as is
+		Scalar horizontal_magnitude = accelerations.at(index).head<2>().norm();
+		if (horizontal_magnitude > a_max_horizontal) {
+			accelerations.at(index).head<2>() *= a_max_horizontal / horizontal_magnitude;
+		}
+		refinement_batch.setAcceleration(index, accelerations.at(index));
+	}
 };
 
 void TrajectoryLibrary::updateInitialAcceleration() {
 	double acceleration_from_thrust = thrust * 9.8/0.7;
 	double a_x_initial = acceleration_from_thrust * sin(pitch);
 	double a_y_initial = -acceleration_from_thrust * cos(pitch)*sin(roll);
-	//double a_z_initial = acceleration_from_thrust * cos(pitch) * cos(roll)-9.8;
 	double a_z_initial = 0;
-
-	initial_acceleration = Vector3(a_x_initial, a_y_initial, a_z_initial);
-
-	for (size_t index = 0; index < trajectories.size(); index++) {
-		trajectories.at(index).setInitialAcceleration(initial_acceleration);
+	if (!is_planar) {
+		a_z_initial = acceleration_from_thrust * cos(pitch) * cos(roll)-9.8;
 	}
 
+	initial_state->setInitialAcceleration(Vector3(a_x_initial, a_y_initial, a_z_initial));
+
 	return;
 };
 
 
 
 void TrajectoryLibrary::setInitialVelocity(Vector3 const& velocity) {
-	initial_velocity = velocity;
-	initial_velocity(2) = 0; // WARNING MUST GET RID OF THIS FOR 3D FLIGHT
-	for (size_t index = 0; index < trajectories.size(); index++) {
-		trajectories.at(index).setInitialVelocity(initial_velocity);
+	Vector3 initial_velocity = velocity;
+	if (is_planar) {
+		initial_velocity(2) = 0; // 2D libraries ignore vertical motion
 	}
+	initial_state->setInitialVelocity(initial_velocity);
 };
 
 
@@ -76,7 +169,7 @@ size_t TrajectoryLibrary::getNumTrajectories() {
 };
 
 Vector3 TrajectoryLibrary::getSigmaAtTime(double const& t) {
-	return Vector3(0.01,0.01,0.01) + t*(Vector3(0.5,0.5,0.5) + 0.1*(initial_velocity.array().abs()).matrix());
+	return Vector3(0.01,0.01,0.01) + t*(Vector3(0.5,0.5,0.5) + 0.1*(initial_state->getInitialVelocity().array().abs()).matrix());
 };
 
 Vector3 TrajectoryLibrary::getInverseSigmaAtTime(double const& t) {
@@ -84,49 +177,21 @@ Vector3 TrajectoryLibrary::getInverseSigmaAtTime(double const& t) {
 	return Vector3(1.0/sigma(0), 1.0/sigma(1), 1.0/sigma(2));
 };
 
-void TrajectoryLibrary::setInitialAccelerationLASER(Vector3 const& initial_acceleration_laser_frame) {
-	this->initial_acceleration_laser_frame = initial_acceleration_laser_frame;
-	for (size_t index = 0; index < trajectories.size(); index++) {
-		trajectories.at(index).setInitialAccelerationLASER(initial_acceleration_laser_frame);
-	}
-	return;
-};
-
-void TrajectoryLibrary::setInitialVelocityLASER(Vector3 const& initial_velocity_laser_frame) {
-	this->initial_velocity_laser_frame = initial_velocity_laser_frame;
-	for (size_t index = 0; index < trajectories.size(); index++) {
-		trajectories.at(index).setInitialVelocityLASER(initial_velocity_laser_frame);
-	}
-	return;
-};
-
-Vector3 TrajectoryLibrary::getLASERSigmaAtTime(double const& t) {
-	return Vector3(0.01,0.01,0.01) + t*(Vector3(0.5,0.5,0.5) + 0.1*(initial_velocity_rdf_frame.array().abs()).matrix());
+void TrajectoryLibrary::setRDFTransform(Matrix3 const& rotation, Vector3 const& translation) {
+	rdf_rotation = rotation;
+	rdf_translation = translation;
 };
 
-Vector3 TrajectoryLibrary::getLASERInverseSigmaAtTime(double const& t) {
-	Vector3 RDFsigma = getLASERSigmaAtTime(t);
-	return Vector3(1.0/RDFsigma(0), 1.0/RDFsigma(1), 1.0/RDFsigma(2));
+void TrajectoryLibrary::TransformSamplesIntoRDFFrame(TrajectorySamples &samples) const {
+	samples.Transform(rdf_rotation, rdf_translation);
 };
 
-void TrajectoryLibrary::setInitialAccelerationRDF(Vector3 const& initial_acceleration_rdf_frame) {
-	this->initial_acceleration_laser_frame = initial_acceleration_laser_frame;
-	for (size_t index = 0; index < trajectories.size(); index++) {
-		trajectories.at(index).setInitialAccelerationLASER(initial_acceleration_laser_frame);
-	}
-	return;
-};
-
-void TrajectoryLibrary::setInitialVelocityRDF(Vector3 const& initial_velocity_rdf_frame) {
-	this->initial_velocity_rdf_frame = initial_velocity_rdf_frame;
-	for (size_t index = 0; index < trajectories.size(); index++) {
-		trajectories.at(index).setInitialVelocityRDF(initial_velocity_rdf_frame);
-	}
-	return;
+Vector3 TrajectoryLibrary::TransformVectorIntoRDFFrame(Vector3 const& ortho_body_vector) const {
+	return rdf_rotation*ortho_body_vector;
 };
 
 Vector3 TrajectoryLibrary::getRDFSigmaAtTime(double const& t) {
-	return Vector3(0.01,0.01,0.01) + t*(Vector3(0.5,0.5,0.5) + 0.1*(initial_velocity_rdf_frame.array().abs()).matrix());
+	return Vector3(0.01,0.01,0.01) + t*(Vector3(0.5,0.5,0.5) + 0.1*(TransformVectorIntoRDFFrame(initial_state->getInitialVelocity()).array().abs()).matrix());
 };
 
 Vector3 TrajectoryLibrary::getRDFInverseSigmaAtTime(double const& t) {
@@ -4,12 +4,15 @@
 
 #include <iostream>
 #include "trajectory.h"
+#include "trajectory_batch.h"
 #include <vector>
 
 class TrajectoryLibrary {
 public:
 
   void Initialize2DLibrary(double const& final_time);
+  void Initialize2DLibrary(double const& final_time, size_t const& num_directions, std::vector<double> const& magnitude_fractions);
+  void Initialize3DLibrary(std::vector<double> const& final_times, size_t const& num_directions, std::vector<double> const& elevation_angles, std::vector<double> const& magnitude_fractions);
 
   void setInitialVelocity(Vector3 const& initialVelocity);
 
@@ -24,12 +27,15 @@ public:
 
   void updateInitialAcceleration();
   Vector3 getInitialAcceleration() const{
-    return initial_acceleration;
+    return initial_state->getInitialAcceleration();
   }
 
 
   Trajectory getTrajectoryFromIndex(size_t index);
   size_t getNumTrajectories();
+  double getFinalTime() const {
+    return final_time;
+  };
   Vector3 getSigmaAtTime(double const& t);
   Vector3 getInverseSigmaAtTime(double const& t);
 
@@ -49,41 +55,54 @@ public:
   return trajectories.end(); 
   };
 
-  void setInitialAccelerationLASER(Vector3 const& initial_acceleration_laser_frame);
-  void setInitialVelocityLASER(Vector3 const& initial_velocity_laser_frame);
-
-  Vector3 getLASERSigmaAtTime(double const& t);
-  Vector3 getLASERInverseSigmaAtTime(double const& t);
-
-  void setInitialAccelerationRDF(Vector3 const& initial_acceleration_laser_frame);
-  void setInitialVelocityRDF(Vector3 const& initial_velocity_laser_frame);
+  // Rigid transform from the ortho-body frame into the depth sensor's RDF frame
+  void setRDFTransform(Matrix3 const& rotation, Vector3 const& translation);
+  void TransformSamplesIntoRDFFrame(TrajectorySamples &samples) const;
+  Vector3 TransformVectorIntoRDFFrame(Vector3 const& ortho_body_vector) const;
 
   Vector3 getRDFSigmaAtTime(double const& t);
   Vector3 getRDFInverseSigmaAtTime(double const& t);
 
+  TrajectoryBatch const& getBatch() const {
+    return batch;
+  };
+
+  // Tabulates terminal stop positions over end-of-trajectory velocities up to max_speed per axis;
+  // rebuild after re-initializing the library. 3D libraries keep the exact offsets
+  void BuildTerminalStopTable(Scalar const& max_speed, size_t const& num_bins, Scalar const& tolerance);
+
+  // Local primitives around library primitives seed_indices, for a second, finer selection stage
+  void UpdateRefinementBatch(std::vector<size_t> const& seed_indices, Scalar const& radius, size_t const& num_directions);
+  TrajectoryBatch const& getRefinementBatch() const {
+    return refinement_batch;
+  };
+
 
 
 private:
+
+  void UpdateBatch(double const& a_max_horizontal, std::vector<size_t> const& horizon_sizes, std::vector<Scalar> const& horizon_scales);
   
   double a_max = 9.8*2.4;  // 2.4 Thrust to weight ratio
 
   std::vector<Trajectory> trajectories;
   Trajectory trajectory1;
 
-  Vector3 initial_velocity = Vector3(0,0,0);
-  Vector3 initial_acceleration = Vector3(0,0,0);
+  TrajectoryBatch batch;
+  TrajectoryBatch refinement_batch;
 
-  Vector3 initial_velocity_laser_frame = Vector3(0,0,0);
-  Vector3 initial_acceleration_laser_frame = Vector3(0,0,0);
+  // Shared by every primitive and the batch, so a state update is O(1) in library size
+  std::shared_ptr<TrajectoryInitialState> initial_state = std::make_shared<TrajectoryInitialState>();
 
-  Vector3 initial_velocity_rdf_frame = Vector3(0,0,0);
-  Vector3 initial_acceleration_rdf_frame = Vector3(0,0,0);
+  Matrix3 rdf_rotation = Matrix3::Identity();
+  Vector3 rdf_translation = Vector3(0,0,0);
 
   double roll = 0;
   double pitch = 0;
   double thrust = 0;
 
   double final_time;
+  bool is_planar = true;
  
 };
 
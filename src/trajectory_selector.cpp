@@ -1,25 +1,77 @@
 #include "trajectory_selector.h"
 
-TrajectoryLibrary* TrajectorySelector::GetTrajectoryLibraryPtr() {
+template <int LibrarySize>
+TrajectoryLibrary* TrajectorySelector<LibrarySize>::GetTrajectoryLibraryPtr() {
   return &trajectory_library;
 };
 
-ValueGridEvaluator* TrajectorySelector::GetValueGridEvaluatorPtr() {
+template <int LibrarySize>
+ValueGridEvaluator* TrajectorySelector<LibrarySize>::GetValueGridEvaluatorPtr() {
   return &value_grid_evaluator;
 };
 
-LaserScanCollisionEvaluator* TrajectorySelector::GetLaserScanCollisionEvaluatorPtr() {
+template <int LibrarySize>
+LaserScanCollisionEvaluator* TrajectorySelector<LibrarySize>::GetLaserScanCollisionEvaluatorPtr() {
   return &laser_scan_collision_evaluator;
 };
 
-DepthImageCollisionEvaluator* TrajectorySelector::GetDepthImageCollisionEvaluatorPtr() {
+template <int LibrarySize>
+DepthImageCollisionEvaluator* TrajectorySelector<LibrarySize>::GetDepthImageCollisionEvaluatorPtr() {
   return &depth_image_collision_evaluator;
 };
 
+template <int LibrarySize>
+DistanceFieldCollisionEvaluator* TrajectorySelector<LibrarySize>::GetDistanceFieldCollisionEvaluatorPtr() {
+  return &distance_field_collision_evaluator;
+};
+
+template <int LibrarySize>
+KDTreeCollisionEvaluator* TrajectorySelector<LibrarySize>::GetKDTreeCollisionEvaluatorPtr() {
+  return &kd_tree_collision_evaluator;
+};
+
 
-void TrajectorySelector::InitializeLibrary(double const& final_time) {
-  trajectory_library.Initialize2DLibrary(final_time);
-  this->final_time = final_time;
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::InitializeLibrary(double const& final_time) {
+  InitializeLibrary(final_time, 8, {1.0, 0.6, 0.15});
+};
+
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::InitializeLibrary(double const& final_time, size_t const& num_directions, std::vector<double> const& magnitude_fractions) {
+  size_t num_trajectories = 1 + num_directions*magnitude_fractions.size();
+  if (LibrarySize != Eigen::Dynamic && num_trajectories != LibrarySize) {
+    throw std::invalid_argument("TrajectorySelector<" + std::to_string(LibrarySize) + "> cannot hold a library of " + std::to_string(num_trajectories) + " trajectories");
+  }
+
+  trajectory_library.Initialize2DLibrary(final_time, num_directions, magnitude_fractions);
+  InitializeEvaluation();
+};
+
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::InitializeLibrary3D(std::vector<double> const& final_times, size_t const& num_directions, std::vector<double> const& elevation_angles, std::vector<double> const& magnitude_fractions) {
+  size_t num_trajectories = final_times.size()*(1 + num_directions*elevation_angles.size()*magnitude_fractions.size());
+  if (LibrarySize != Eigen::Dynamic && num_trajectories != LibrarySize) {
+    throw std::invalid_argument("TrajectorySelector<" + std::to_string(LibrarySize) + "> cannot hold a library of " + std::to_string(num_trajectories) + " trajectories");
+  }
+
+  trajectory_library.Initialize3DLibrary(final_times, num_directions, elevation_angles, magnitude_fractions);
+  InitializeEvaluation();
+};
+
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::InitializeEvaluation() {
+  size_t num_trajectories = trajectory_library.getNumTrajectories();
+  this->final_time = trajectory_library.getFinalTime();
+  UpdateEvaluationOrder();
+  num_active_trajectories = num_trajectories;
+
+  dijkstra_evaluations.resize(num_trajectories);
+  goal_progress_evaluations.resize(num_trajectories);
+  terminal_velocity_evaluations.resize(num_trajectories);
+  collision_probabilities.resize(num_trajectories);
+  no_collision_probabilities.resize(num_trajectories);
+  objectives_dijkstra.resize(num_trajectories);
+  objectives_euclid.resize(num_trajectories);
 
   size_t num_samples = 10;
   double sampling_time = 0;
@@ -35,26 +87,155 @@ void TrajectorySelector::InitializeLibrary(double const& final_time) {
       sampling_time = start_time + sampling_interval*(sample_index+1);
       collision_sampling_time_vector(sample_index) = sampling_time;
   }
+
+  UpdateSamplingBases();
+
+  if (trajectory_tree.isInitialized()) {
+    InitializeTree(trajectory_tree.getSplitTime());
+  }
+};
+
+// Roots and children each get half of the collision samples, so a full two-segment path is sampled as densely as a library primitive
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::InitializeTree(Scalar const& split_time) {
+  trajectory_tree.Initialize(trajectory_library.getBatch(), split_time);
+
+  size_t num_samples_segment = num_samples_collision / 2;
+  VectorX root_sampling_time_vector(num_samples_segment);
+  VectorX child_sampling_time_vector(num_samples_segment);
+  for (size_t sample_index = 0; sample_index < num_samples_segment; sample_index++) {
+    root_sampling_time_vector(sample_index) = split_time*(sample_index+1)/num_samples_segment;
+    child_sampling_time_vector(sample_index) = (final_time - split_time)*(sample_index+1)/num_samples_segment;
+  }
+
+  Scalar jerk_time = trajectory_library.getBatch().getJerkTime();
+  tree_root_basis.Build(root_sampling_time_vector, jerk_time, trajectory_library.getBatch().getHorizonScales());
+  tree_child_basis.Build(child_sampling_time_vector, jerk_time);
+  // Same reference time for the terminal velocity as the single-segment evaluators
+  tree_terminal_velocity_on_roots = split_time > terminal_velocity_time;
+  tree_child_velocity_basis.Build(Vector1(std::max(terminal_velocity_time - split_time, (Scalar) 0.0)), jerk_time);
+};
+
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::UpdateSamplingBases() {
+  Scalar jerk_time = trajectory_library.getBatch().getJerkTime();
+  std::vector<Scalar> const& horizon_scales = trajectory_library.getBatch().getHorizonScales();
+  sampling_basis.Build(sampling_time_vector, jerk_time, horizon_scales);
+  collision_sampling_basis.Build(collision_sampling_time_vector, jerk_time, horizon_scales);
+  terminal_velocity_basis.Build(Vector1(terminal_velocity_time), jerk_time, horizon_scales);
 };
 
 
-size_t TrajectorySelector::getNumTrajectories() {
+template <int LibrarySize>
+size_t TrajectorySelector<LibrarySize>::getNumTrajectories() {
   return trajectory_library.getNumTrajectories();
 };
 
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::setRefinement(bool const& enabled, Scalar const& radius, size_t const& num_directions) {
+  refinement_enabled = enabled;
+  refinement_radius = radius;
+  refinement_num_directions = num_directions;
+};
+
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::setLogDomainCollision(bool const& enabled, Scalar const& saturation) {
+  log_domain_collision = enabled;
+  collision_saturation = saturation;
+  depth_image_collision_evaluator.setLogDomain(enabled, saturation);
+};
+
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::setEvaluationBudget(double const& budget_microseconds) {
+  evaluation_budget = budget_microseconds;
+  if (evaluation_budget <= 0) {
+    num_active_trajectories = getNumTrajectories();
+  }
+};
+
+template <int LibrarySize>
+size_t TrajectorySelector<LibrarySize>::getNumActiveTrajectories() {
+  return num_active_trajectories;
+};
+
+template <int LibrarySize>
+bool TrajectorySelector<LibrarySize>::IsActive(size_t const& trajectory_index) const {
+  return evaluation_rank[trajectory_index] < num_active_trajectories;
+};
+
+// Farthest-point order over the primitives' accelerations, starting from the first (hover) primitive: each next
+// primitive is the one farthest from all those before it, so a prefix of a ring library alternates between
+// opposite and then intermediate headings instead of repeating one heading per ring
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::UpdateEvaluationOrder() {
+  size_t num_trajectories = getNumTrajectories();
+  std::vector<Vector3> accelerations(num_trajectories);
+  for (size_t i = 0; i < num_trajectories; i++) {
+    accelerations[i] = trajectory_library.getTrajectoryFromIndex(i).getAcceleration();
+  }
+
+  evaluation_order.assign(1, 0);
+  evaluation_rank.assign(num_trajectories, 0);
+  std::vector<Scalar> distance_to_ordered(num_trajectories, std::numeric_limits<Scalar>::infinity());
+  std::vector<bool> ordered(num_trajectories, false);
+  ordered[0] = true;
+  for (size_t rank = 1; rank < num_trajectories; rank++) {
+    size_t last = evaluation_order.back();
+    size_t farthest = num_trajectories;
+    for (size_t i = 0; i < num_trajectories; i++) {
+      if (ordered[i]) {
+        continue;
+      }
+      distance_to_ordered[i] = std::min(distance_to_ordered[i], (accelerations[i] - accelerations[last]).norm());
+      if (farthest == num_trajectories || distance_to_ordered[i] > distance_to_ordered[farthest]) {
+        farthest = i;
+      }
+    }
+    ordered[farthest] = true;
+    evaluation_rank[farthest] = rank;
+    evaluation_order.push_back(farthest);
+  }
+};
+
+// Evaluates only a prefix of evaluation_order when the measured cost would exceed the budget.
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::UpdateEvaluationBudget(std::chrono::high_resolution_clock::duration const& evaluation_duration) {
+  last_evaluation_time = std::chrono::duration_cast<std::chrono::microseconds>(evaluation_duration).count();
+  // Clock ticks can round a fast evaluation down to 0 us, so the per-trajectory time is kept positive
+  double time_per_trajectory = std::max(min_evaluation_time_per_trajectory, last_evaluation_time / getNumActiveTrajectories());
+  if (evaluation_time_per_trajectory == 0) {
+    evaluation_time_per_trajectory = time_per_trajectory;
+  }
+  else {
+    evaluation_time_per_trajectory = 0.9*evaluation_time_per_trajectory + 0.1*time_per_trajectory;
+  }
+
+  if (evaluation_budget <= 0) {
+    return;
+  }
+  size_t affordable_trajectories = std::max(1.0, floor(evaluation_budget / evaluation_time_per_trajectory));
+  num_active_trajectories = std::min(getNumTrajectories(), affordable_trajectories);
+};
+
 
 // Euclidean Evaluator
-void TrajectorySelector::computeBestEuclideanTrajectory(Vector3 const& carrot_body_frame, size_t &best_traj_index, Vector3 &desired_acceleration) {
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::computeBestEuclideanTrajectory(Vector3 const& carrot_body_frame, size_t &best_traj_index, Vector3 &desired_acceleration) {
+  auto t1 = std::chrono::high_resolution_clock::now();
   EvaluateCollisionProbabilities();
   EvaluateGoalProgress(carrot_body_frame); 
   EvaluateTerminalVelocityCost();
   EvaluateObjectivesEuclid();
+  UpdateEvaluationBudget(std::chrono::high_resolution_clock::now() - t1);
 
   desired_acceleration << 0,0,0;
   best_traj_index = 0;
-  float current_objective_value;
-  float best_traj_objective_value = objectives_euclid(0);
-  for (size_t traj_index = 1; traj_index < 25; traj_index++) {
+  Scalar current_objective_value;
+  Scalar best_traj_objective_value = objectives_euclid(0);
+  for (size_t traj_index = 1; traj_index < objectives_euclid.size(); traj_index++) {
+    if (!IsActive(traj_index)) {
+      continue;
+    }
     current_objective_value = objectives_euclid(traj_index);
     if (current_objective_value > best_traj_objective_value) {
       best_traj_index = traj_index;
@@ -62,35 +243,179 @@ void TrajectorySelector::computeBestEuclideanTrajectory(Vector3 const& carrot_bo
     }
   }
   desired_acceleration = trajectory_library.getTrajectoryFromIndex(best_traj_index).getAcceleration();
+
+  if (refinement_enabled) {
+    RefineBestEuclideanTrajectory(carrot_body_frame, best_traj_index, desired_acceleration);
+  }
+};
+
+// Second stage: re-select among primitives close to the best and runner-up coarse primitives.
+// Candidates are scored on the coarse objectives' scale and both seeds are among them, so the refined choice
+// scores at least as well as the coarse one; best_traj_index becomes the seed it was refined from.
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::RefineBestEuclideanTrajectory(Vector3 const& carrot_body_frame, size_t &best_traj_index, Vector3 &desired_acceleration) {
+  std::vector<size_t> seed_indices(1, best_traj_index);
+  size_t runner_up_index = best_traj_index;
+  for (size_t traj_index = 0; traj_index < objectives_euclid.size(); traj_index++) {
+    if (traj_index == best_traj_index || !IsActive(traj_index)) {
+      continue;
+    }
+    if (runner_up_index == best_traj_index || objectives_euclid(traj_index) > objectives_euclid(runner_up_index)) {
+      runner_up_index = traj_index;
+    }
+  }
+  if (runner_up_index != best_traj_index) {
+    seed_indices.push_back(runner_up_index);
+  }
+
+  trajectory_library.UpdateRefinementBatch(seed_indices, refinement_radius, refinement_num_directions);
+  TrajectoryBatch const& refinement_batch = trajectory_library.getRefinementBatch();
+  size_t num_refined = refinement_batch.getNumTrajectories();
+
+  refinement_collision_basis.Build(collision_sampling_time_vector, refinement_batch.getJerkTime(), refinement_batch.getHorizonScales());
+  refinement_batch.Sample(refinement_collision_basis, &refinement_samples, nullptr);
+  trajectory_library.TransformSamplesIntoRDFFrame(refinement_samples);
+  refinement_no_collision_probabilities.resize(num_refined);
+  computeProbabilitiesOfCollision(refinement_samples, 1, refinement_no_collision_probabilities);
+  refinement_no_collision_probabilities = VectorX::Ones(num_refined) - refinement_no_collision_probabilities;
+
+  Scalar initial_distance = carrot_body_frame.norm();
+  refinement_batch.SampleTerminalStopPositions(final_time, terminal_stop_positions);
+  refinement_batch.Sample(Vector1(terminal_velocity_time), nullptr, &terminal_velocity_samples);
+  refinement_objectives.resize(num_refined);
+  for (size_t i = 0; i < num_refined; i++) {
+    Scalar goal_progress = initial_distance - (terminal_stop_positions.row(i).transpose().matrix() - carrot_body_frame).norm();
+    Scalar weighted_objective = goal_progress + 1.0*computeTerminalVelocityCost(terminal_velocity_samples.getSample(i, 0).norm());
+    Scalar no_collision = refinement_no_collision_probabilities(i);
+    if (no_collision_max != no_collision_min) {
+      no_collision = (no_collision - no_collision_min)/(no_collision_max - no_collision_min);
+    }
+    refinement_objectives(i) = (weighted_objective - euclid_weighted_min + 1.0)*no_collision;
+  }
+
+  VectorX::Index best_refined_index;
+  refinement_objectives.maxCoeff(&best_refined_index);
+  desired_acceleration = refinement_batch.getAcceleration(best_refined_index);
+  // Each seed's candidates are one contiguous block, seed first
+  best_traj_index = seed_indices.at(best_refined_index / (num_refined / seed_indices.size()));
+};
+
+// Two-segment Euclidean evaluator over the trajectory tree.
+// Each root's collision term is evaluated once and multiplied into all of its children's.
+// Children of roots at or past collision_saturation are not collision checked; they keep the root's
+// no-collision probability, an upper bound at most 1 - collision_saturation.
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::computeBestTwoSegmentTrajectory(Vector3 const& carrot_body_frame, size_t &best_traj_index, Vector3 &desired_acceleration) {
+  trajectory_tree.UpdateChildStates();
+  size_t num_roots = trajectory_tree.getNumRoots();
+  size_t num_children = trajectory_tree.getNumChildren();
+  tree_no_collision_probabilities.resize(num_roots*num_children);
+  tree_objectives.resize(num_roots*num_children);
+
+  trajectory_library.getBatch().Sample(tree_root_basis, &tree_root_samples, nullptr);
+  trajectory_library.TransformSamplesIntoRDFFrame(tree_root_samples);
+  tree_root_collision_probabilities.resize(num_roots);
+  computeProbabilitiesOfCollision(tree_root_samples, 1, tree_root_collision_probabilities);
+  tree_child_collision_probabilities.resize(num_children);
+
+  if (tree_terminal_velocity_on_roots) {
+    trajectory_library.getBatch().Sample(terminal_velocity_basis, nullptr, &terminal_velocity_samples);
+    tree_root_terminal_velocity_costs.resize(num_roots);
+    for (size_t root = 0; root < num_roots; root++) {
+      tree_root_terminal_velocity_costs(root) = computeTerminalVelocityCost(terminal_velocity_samples.getSample(root, 0).norm());
+    }
+  }
+
+  Scalar initial_distance = carrot_body_frame.norm();
+  Scalar child_time = final_time - trajectory_tree.getSplitTime();
+  for (size_t root = 0; root < num_roots; root++) {
+    Scalar prefix_no_collision = 1.0 - tree_root_collision_probabilities(root);
+
+    bool saturated = tree_root_collision_probabilities(root) >= collision_saturation;
+    if (saturated) {
+      tree_child_collision_probabilities.setZero();
+    } else {
+      trajectory_tree.SampleChildren(root, tree_child_basis, &tree_child_samples, nullptr);
+      trajectory_library.TransformSamplesIntoRDFFrame(tree_child_samples);
+      computeProbabilitiesOfCollision(tree_child_samples, 1, tree_child_collision_probabilities);
+    }
+    if (!tree_terminal_velocity_on_roots) {
+      trajectory_tree.SampleChildren(root, tree_child_velocity_basis, nullptr, &terminal_velocity_samples);
+    }
+    trajectory_tree.SampleChildTerminalStopPositions(root, child_time, terminal_stop_positions);
+
+    for (size_t child = 0; child < num_children; child++) {
+      size_t index = root*num_children + child;
+      tree_no_collision_probabilities(index) = prefix_no_collision*(1.0 - tree_child_collision_probabilities(child));
+      Scalar goal_progress = initial_distance - (terminal_stop_positions.row(child).transpose().matrix() - carrot_body_frame).norm();
+      Scalar terminal_velocity_cost = tree_terminal_velocity_on_roots ? tree_root_terminal_velocity_costs(root) : computeTerminalVelocityCost(terminal_velocity_samples.getSample(child, 0).norm());
+      tree_objectives(index) = goal_progress + 1.0*terminal_velocity_cost;
+    }
+  }
+
+  tree_objectives = MakeAllGreaterThan1(tree_objectives);
+  tree_objectives = tree_objectives.cwiseProduct(Normalize0to1(tree_no_collision_probabilities));
+
+  VectorX::Index best_index;
+  tree_objectives.maxCoeff(&best_index);
+  best_traj_index = best_index / num_children;
+  desired_acceleration = trajectory_library.getTrajectoryFromIndex(best_traj_index).getAcceleration();
 };
 
-void TrajectorySelector::EvaluateObjectivesEuclid() {
-  for (int i = 0; i < 25; i++) {
-    objectives_euclid(i) = EvaluateWeightedObjectiveEuclid(i);
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::EvaluateObjectivesEuclid() {
+  for (size_t k = 0; k < num_active_trajectories; k++) {
+    objectives_euclid(evaluation_order[k]) = EvaluateWeightedObjectiveEuclid(evaluation_order[k]);
   }
+  FillInactiveWithActiveMinimum(objectives_euclid);
+  euclid_weighted_min = objectives_euclid.minCoeff();
+  no_collision_min = no_collision_probabilities.minCoeff();
+  no_collision_max = no_collision_probabilities.maxCoeff();
   objectives_euclid = MakeAllGreaterThan1(objectives_euclid);
   no_collision_probabilities = Normalize0to1(no_collision_probabilities);
   objectives_euclid = objectives_euclid.cwiseProduct(no_collision_probabilities);
 }
 
-double TrajectorySelector::EvaluateWeightedObjectiveEuclid(size_t const& trajectory_index) {
+// Inactive primitives score no better than the worst evaluated one, so they neither win nor shift the normalization
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::FillInactiveWithActiveMinimum(Eigen::Ref<VectorX> values) {
+  if (num_active_trajectories == getNumTrajectories()) {
+    return;
+  }
+  Scalar active_min = values(evaluation_order[0]);
+  for (size_t k = 1; k < num_active_trajectories; k++) {
+    active_min = std::min(active_min, values(evaluation_order[k]));
+  }
+  for (size_t k = num_active_trajectories; k < evaluation_order.size(); k++) {
+    values(evaluation_order[k]) = active_min;
+  }
+}
+
+template <int LibrarySize>
+Scalar TrajectorySelector<LibrarySize>::EvaluateWeightedObjectiveEuclid(size_t const& trajectory_index) {
   return goal_progress_evaluations(trajectory_index) + 1.0*terminal_velocity_evaluations(trajectory_index);
 }
 
 
 // Dijkstra Evaluator
-void TrajectorySelector::computeBestDijkstraTrajectory(Vector3 const& carrot_body_frame, Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf, size_t &best_traj_index, Vector3 &desired_acceleration) {
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::computeBestDijkstraTrajectory(Vector3 const& carrot_body_frame, Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf, size_t &best_traj_index, Vector3 &desired_acceleration) {
+  auto t1 = std::chrono::high_resolution_clock::now();
   EvaluateCollisionProbabilities();
   EvaluateDijkstraCost(carrot_world_frame, tf);
   EvaluateGoalProgress(carrot_body_frame); 
   EvaluateTerminalVelocityCost();
   EvaluateObjectivesDijkstra();
+  UpdateEvaluationBudget(std::chrono::high_resolution_clock::now() - t1);
 
   desired_acceleration << 0,0,0;
   best_traj_index = 0;
-  double current_objective_value;
-  double best_traj_objective_value = objectives_dijkstra(0);
-  for (size_t traj_index = 1; traj_index < 25; traj_index++) {
+  Scalar current_objective_value;
+  Scalar best_traj_objective_value = objectives_dijkstra(0);
+  for (size_t traj_index = 1; traj_index < objectives_dijkstra.size(); traj_index++) {
+    if (!IsActive(traj_index)) {
+      continue;
+    }
     current_objective_value = objectives_dijkstra(traj_index);
     if (current_objective_value > best_traj_objective_value) {
       best_traj_index = traj_index;
@@ -101,10 +426,12 @@ void TrajectorySelector::computeBestDijkstraTrajectory(Vector3 const& carrot_bod
   return;
 }
 
-void TrajectorySelector::EvaluateObjectivesDijkstra() {
-  for (int i = 0; i < 25; i++) {
-    objectives_dijkstra(i) = EvaluateWeightedObjectiveDijkstra(i);
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::EvaluateObjectivesDijkstra() {
+  for (size_t k = 0; k < num_active_trajectories; k++) {
+    objectives_dijkstra(evaluation_order[k]) = EvaluateWeightedObjectiveDijkstra(evaluation_order[k]);
   }
+  FillInactiveWithActiveMinimum(objectives_dijkstra);
   objectives_dijkstra = MakeAllGreaterThan1(objectives_dijkstra);
   no_collision_probabilities = Normalize0to1(no_collision_probabilities);
   objectives_dijkstra = objectives_dijkstra.cwiseProduct(no_collision_probabilities);
@@ -113,52 +440,43 @@ void TrajectorySelector::EvaluateObjectivesDijkstra() {
 
 
 
-double TrajectorySelector::EvaluateWeightedObjectiveDijkstra(size_t index) {
+template <int LibrarySize>
+Scalar TrajectorySelector<LibrarySize>::EvaluateWeightedObjectiveDijkstra(size_t index) {
   return dijkstra_evaluations(index) + 0.2*goal_progress_evaluations(index) + 1.0*terminal_velocity_evaluations(index);
 }
 
 
 
-void TrajectorySelector::EvaluateDijkstraCost(Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf) {
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::EvaluateDijkstraCost(Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf) {
 
-  ValueGrid* value_grid_ptr = value_grid_evaluator.GetValueGridPtr();
+  ValueGrid const* value_grid_ptr = value_grid_evaluator.GetValueGridPtr();
 
-  std::vector<Trajectory>::const_iterator trajectory_iterator_begin = trajectory_library.GetTrajectoryIteratorBegin();
-  std::vector<Trajectory>::const_iterator trajectory_iterator_end = trajectory_library.GetTrajectoryIteratorEnd();
+  trajectory_library.getBatch().Sample(sampling_basis, &dijkstra_samples, nullptr);
 
-  size_t i = 0;
-  Vector3 ortho_body_frame_position;
-  geometry_msgs::PoseStamped pose_ortho_body_frame_position;
-  geometry_msgs::PoseStamped pose_world_frame_position = PoseFromVector3(Vector3(0,0,0), "world");
-  int current_value;
-  // Iterate over trajectories
-  for (auto trajectory = trajectory_iterator_begin; trajectory != trajectory_iterator_end; trajectory++) {
-    
-   dijkstra_evaluations(i) = 0;
-    double sampling_time;
-    //Iterate over sampling times
-    for (size_t time_index = 0; time_index < sampling_time_vector.size(); time_index++) {
-      
-      sampling_time = sampling_time_vector(time_index);
-      ortho_body_frame_position = trajectory->getPosition(sampling_time);
-      
-      geometry_msgs::PoseStamped pose_ortho_body_frame_position = PoseFromVector3(ortho_body_frame_position, "ortho_body");
-      tf2::doTransform(pose_ortho_body_frame_position, pose_world_frame_position, tf);
-      Vector3 world_frame_position = VectorFromPose(pose_world_frame_position);
-
-      // // Then evaluate Dijkstra cost
-      current_value = value_grid_ptr->GetValueOfPosition(world_frame_position);
-
-      if ((current_value == 0) && ((world_frame_position - carrot_world_frame).norm() > 1.0)) {
-        current_value = 1000;
-      }
-
-      dijkstra_evaluations(i) -= current_value;
+  // ortho_body to world once as an Eigen isometry, applied to each sample as tf2::doTransform applies it to a pose
+  geometry_msgs::Vector3 const& translation = tf.transform.translation;
+  geometry_msgs::Quaternion const& rotation = tf.transform.rotation;
+  Eigen::Transform<Scalar, 3, Eigen::Isometry> ortho_body_to_world = Eigen::Translation<Scalar, 3>(translation.x, translation.y, translation.z)
+    * Eigen::Quaternion<Scalar>(rotation.w, rotation.x, rotation.y, rotation.z).normalized();
 
+  // Value grid lookups only read the grid, so primitives are split across the pool
+  size_t num_samples = dijkstra_samples.getNumSamples();
+  worker_pool.ParallelFor((num_active_trajectories + primitive_chunk_size - 1) / primitive_chunk_size, [&](size_t chunk) {
+    for (size_t k = chunk*primitive_chunk_size; k < std::min(num_active_trajectories, (chunk + 1)*primitive_chunk_size); k++) {
+      size_t i = evaluation_order[k];
+      Scalar dijkstra_evaluation = 0;
+      for (size_t time_index = 0; time_index < num_samples; time_index++) {
+        Vector3 world_frame_position = ortho_body_to_world * dijkstra_samples.getSample(i, time_index);
+        int current_value = value_grid_ptr->GetValueOfPosition(world_frame_position);
+        if ((current_value == 0) && ((world_frame_position - carrot_world_frame).norm() > 1.0)) {
+          current_value = 1000;
+        }
+        dijkstra_evaluation -= current_value;
+      }
+      dijkstra_evaluations(i) = dijkstra_evaluation;
     }
-    
-    i++;
-  }
+  });
   //std::cout << "At the end of all this, my Dijkstra evaluations are: " << dijkstra_evaluations << std::endl;
 };
 
@@ -169,85 +487,118 @@ void TrajectorySelector::EvaluateDijkstraCost(Vector3 const& carrot_world_frame,
 
 
 
-void TrajectorySelector::EvaluateGoalProgress(Vector3 const& carrot_body_frame) {
-
-  // for each traj in trajectory_library.trajectories
-  std::vector<Trajectory>::const_iterator trajectory_iterator_begin = trajectory_library.GetTrajectoryIteratorBegin();
-  std::vector<Trajectory>::const_iterator trajectory_iterator_end = trajectory_library.GetTrajectoryIteratorEnd();
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::EvaluateGoalProgress(Vector3 const& carrot_body_frame) {
 
-  double initial_distance = carrot_body_frame.norm();
+  Scalar initial_distance = carrot_body_frame.norm();
 
   //std::cout << "initial_distance is " << initial_distance << std::endl;
 
-  size_t i = 0;
-  Vector3 final_trajectory_position;
-  double distance;
-  for (auto trajectory = trajectory_iterator_begin; trajectory != trajectory_iterator_end; trajectory++) {
-    final_trajectory_position = trajectory->getTerminalStopPosition(final_time);
-    // if (final_trajectory_position.norm() < initial_distance) {
-    //   final_trajectory_position = trajectory->getPosition(final_time);
-    // }
-    distance = (final_trajectory_position - carrot_body_frame).norm();
-    goal_progress_evaluations(i) = initial_distance - distance; 
-    i++;
-  }
+  trajectory_library.getBatch().SampleTerminalStopPositions(final_time, terminal_stop_positions);
+
+  worker_pool.ParallelFor((num_active_trajectories + primitive_chunk_size - 1) / primitive_chunk_size, [&](size_t chunk) {
+    Scalar distance;
+    for (size_t k = chunk*primitive_chunk_size; k < std::min(num_active_trajectories, (chunk + 1)*primitive_chunk_size); k++) {
+      size_t i = evaluation_order[k];
+      distance = (terminal_stop_positions.row(i).transpose().matrix() - carrot_body_frame).norm();
+      goal_progress_evaluations(i) = initial_distance - distance; 
+    }
+  });
 };
 
 
-void TrajectorySelector::EvaluateTerminalVelocityCost() {
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::EvaluateTerminalVelocityCost() {
 
-  // for each traj in trajectory_library.trajectories
-  std::vector<Trajectory>::const_iterator trajectory_iterator_begin = trajectory_library.GetTrajectoryIteratorBegin();
-  std::vector<Trajectory>::const_iterator trajectory_iterator_end = trajectory_library.GetTrajectoryIteratorEnd();
+  trajectory_library.getBatch().Sample(terminal_velocity_basis, nullptr, &terminal_velocity_samples);
 
-  size_t i = 0;
-  double final_trajectory_speed;
-  double distance;
-  for (auto trajectory = trajectory_iterator_begin; trajectory != trajectory_iterator_end; trajectory++) {
-    final_trajectory_speed = trajectory->getVelocity(0.5).norm();
-    terminal_velocity_evaluations(i) = 0;
-    
-    // cost on going too fast
-    if (final_trajectory_speed > (soft_top_speed-1.0)) {
-      terminal_velocity_evaluations(i) -= ((soft_top_speed-1.0) - final_trajectory_speed)*((soft_top_speed-1.0) - final_trajectory_speed);
-    }
+  for (size_t k = 0; k < num_active_trajectories; k++) {
+    size_t i = evaluation_order[k];
+    terminal_velocity_evaluations(i) = computeTerminalVelocityCost(terminal_velocity_samples.getSample(i, 0).norm());
+  }
+};
+
+template <int LibrarySize>
+Scalar TrajectorySelector<LibrarySize>::computeTerminalVelocityCost(Scalar const& final_trajectory_speed) {
+  Scalar terminal_velocity_evaluation = 0;
 
-    i++;
+  // cost on going too fast
+  if (final_trajectory_speed > (soft_top_speed-1.0)) {
+    terminal_velocity_evaluation -= ((soft_top_speed-1.0) - final_trajectory_speed)*((soft_top_speed-1.0) - final_trajectory_speed);
   }
+  return terminal_velocity_evaluation;
 };
 
 
 
-void TrajectorySelector::EvaluateCollisionProbabilities() {
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::EvaluateCollisionProbabilities() {
   
-  // for each traj in trajectory_library.trajectories
-  std::vector<Trajectory>::const_iterator trajectory_iterator_begin = trajectory_library.GetTrajectoryIteratorBegin();
-  std::vector<Trajectory>::const_iterator trajectory_iterator_end = trajectory_library.GetTrajectoryIteratorEnd();
+  trajectory_library.getBatch().Sample(collision_sampling_basis, &collision_samples, nullptr);
+  trajectory_library.TransformSamplesIntoRDFFrame(collision_samples);
 
-  size_t i = 0;
-  for (auto trajectory = trajectory_iterator_begin; trajectory != trajectory_iterator_end; trajectory++) {
-    collision_probabilities(i) = computeProbabilityOfCollisionOneTrajectory(*trajectory);   
-    i++;
+  // Inactive primitives are treated as colliding
+  collision_probabilities.setOnes();
+  if (num_active_trajectories == collision_samples.getNumTrajectories()) {
+    computeProbabilitiesOfCollision(collision_samples, 1, collision_probabilities);
   }
-  for (int i = 0; i < 25; i++) {
+  else {
+    size_t num_samples = collision_samples.getNumSamples();
+    active_collision_samples.resize(num_active_trajectories, num_samples);
+    for (size_t k = 0; k < num_active_trajectories; k++) {
+      for (size_t axis = 0; axis < 3; axis++) {
+        active_collision_samples.axis[axis].row(k) = collision_samples.axis[axis].row(evaluation_order[k]);
+      }
+    }
+    active_collision_probabilities.resize(num_active_trajectories);
+    computeProbabilitiesOfCollision(active_collision_samples, 1, active_collision_probabilities);
+    for (size_t k = 0; k < num_active_trajectories; k++) {
+      collision_probabilities(evaluation_order[k]) = active_collision_probabilities(k);
+    }
+  }
+  for (int i = 0; i < no_collision_probabilities.size(); i++) {
     no_collision_probabilities(i) = 1.0 - collision_probabilities(i);
   }
 };
 
-double TrajectorySelector::computeProbabilityOfCollisionOneTrajectory(Trajectory trajectory) {
-  double probability_no_collision = 1;
-  double probability_of_collision_one_step = 0.0;
-  double probability_no_collision_one_step = 1.0;
+// Every trajectory_stride'th row of collision_samples in one batched query, on the worker pool where the
+// evaluator supports it; the depth evaluator accumulates in the log domain when setLogDomainCollision is on
+template <int LibrarySize>
+void TrajectorySelector<LibrarySize>::computeProbabilitiesOfCollision(TrajectorySamples const& collision_samples, size_t const& trajectory_stride, Eigen::Ref<VectorX> probabilities) {
+  if (distance_field_collision) {
+    distance_field_collision_evaluator.EvaluateBatch(collision_samples, Vector3(0.01,0.01,0.01), trajectory_stride, probabilities);
+    return;
+  }
+  if (kd_tree_collision) {
+    kd_tree_collision_evaluator.EvaluateBatch(collision_samples, Vector3(0.01,0.01,0.01), trajectory_stride, probabilities, &worker_pool);
+    return;
+  }
+  if (inflated_collision) {
+    depth_image_collision_evaluator.EvaluateBatchInflated(collision_samples, Vector3(0.01,0.01,0.01), trajectory_stride, probabilities);
+    return;
+  }
+  depth_image_collision_evaluator.EvaluateBatch(collision_samples, Vector3(0.01,0.01,0.01), collision_block_increment, trajectory_stride, probabilities, &worker_pool);
+};
+
+template <int LibrarySize>
+Scalar TrajectorySelector<LibrarySize>::computeProbabilityOfCollisionOneTrajectory(TrajectorySamples const& collision_samples, size_t trajectory_index) {
+  if (log_domain_collision) {
+    return computeProbabilityOfCollisionOneTrajectoryLogDomain(collision_samples, trajectory_index);
+  }
+
+  Scalar probability_no_collision = 1;
+  Scalar probability_of_collision_one_step = 0.0;
+  Scalar probability_no_collision_one_step = 1.0;
   Vector3 robot_position;
   Vector3 sigma_robot_position;
 
-  for (size_t time_step_index = 0; time_step_index < num_samples_collision; time_step_index++) {
-    //sigma_robot_position = trajectory_library.getLASERSigmaAtTime(collision_sampling_time_vector(time_step_index)); 
+  for (size_t time_step_index = 0; time_step_index < collision_samples.getNumSamples(); time_step_index++) {
+    //sigma_robot_position = trajectory_library.getRDFSigmaAtTime(collision_sampling_time_vector(time_step_index)); 
     
     sigma_robot_position = Vector3(0.01,0.01,0.01);
-    robot_position = trajectory.getPositionRDF(collision_sampling_time_vector(time_step_index));
+    robot_position = collision_samples.getSample(trajectory_index, time_step_index);
     
-    probability_of_collision_one_step = depth_image_collision_evaluator.computeProbabilityOfCollisionOnePositionBlock(robot_position, sigma_robot_position, 10);
+    probability_of_collision_one_step = depth_image_collision_evaluator.computeProbabilityOfCollisionOnePositionBlockVectorized(robot_position, sigma_robot_position, collision_block_increment);
     //probability_of_collision_one_step = depth_image_collision_evaluator.computeProbabilityOfCollisionOnePositionBlockMarching(robot_position, sigma_robot_position, 50);
     // if (depth_image_collision_evaluator.computeDeterministicCollisionOnePositionKDTree(robot_position, sigma_robot_position)) {
     //   return 1.0;
@@ -264,11 +615,31 @@ double TrajectorySelector::computeProbabilityOfCollisionOneTrajectory(Trajectory
 
 };
 
-Eigen::Matrix<Scalar, 25, 1> TrajectorySelector::Normalize0to1(Eigen::Matrix<Scalar, 25, 1> cost) {
-  double max = cost(0);
-  double min = cost(0);
-  double current;
-  for (int i = 1; i < 25; i++) {
+// Sums log(1 - p) over time samples and pixels, and stops once the collision probability reaches collision_saturation.
+// Saturated trajectories report a probability of at least collision_saturation rather than the full product.
+template <int LibrarySize>
+Scalar TrajectorySelector<LibrarySize>::computeProbabilityOfCollisionOneTrajectoryLogDomain(TrajectorySamples const& collision_samples, size_t trajectory_index) {
+  Scalar log_no_collision_floor = std::log1p(-collision_saturation);
+  Scalar log_probability_no_collision = 0;
+  Vector3 sigma_robot_position = Vector3(0.01,0.01,0.01);
+
+  for (size_t time_step_index = 0; time_step_index < collision_samples.getNumSamples(); time_step_index++) {
+    Vector3 robot_position = collision_samples.getSample(trajectory_index, time_step_index);
+    log_probability_no_collision += depth_image_collision_evaluator.computeLogProbabilityOfNoCollisionOnePositionBlock(robot_position, sigma_robot_position, collision_block_increment, log_no_collision_floor - log_probability_no_collision);
+    if (log_probability_no_collision <= log_no_collision_floor) {
+      break;
+    }
+  }
+  return -std::expm1(log_probability_no_collision);
+};
+
+template <int LibrarySize>
+template <typename CostVector>
+CostVector TrajectorySelector<LibrarySize>::Normalize0to1(CostVector cost) {
+  Scalar max = cost(0);
+  Scalar min = cost(0);
+  Scalar current;
+  for (int i = 1; i < cost.size(); i++) {
     current = cost(i);
     if (current > max) {
       max = current;
@@ -282,30 +653,33 @@ Eigen::Matrix<Scalar, 25, 1> TrajectorySelector::Normalize0to1(Eigen::Matrix<Sca
     return cost;
   }
 
-  for (int i = 0; i < 25; i++) {
+  for (int i = 0; i < cost.size(); i++) {
      cost(i) =  (cost(i)-min)/(max-min);
   }
   return cost;
 }
 
-Eigen::Matrix<Scalar, 25, 1> TrajectorySelector::MakeAllGreaterThan1(Eigen::Matrix<Scalar, 25, 1> cost) {
-  double min = cost(0);
-  double current;
-  for (int i = 1; i < 25; i++) {
+template <int LibrarySize>
+template <typename CostVector>
+CostVector TrajectorySelector<LibrarySize>::MakeAllGreaterThan1(CostVector cost) {
+  Scalar min = cost(0);
+  Scalar current;
+  for (int i = 1; i < cost.size(); i++) {
     current = cost(i);
     if (current < min) {
       min = current;
     }
   }
 
-  for (int i = 0; i < 25; i++) {
+  for (int i = 0; i < cost.size(); i++) {
      cost(i) =  cost(i)-min+1.0;
   }
   return cost;
 }
 
-Eigen::Matrix<Scalar, 25, 1> TrajectorySelector::FilterSmallProbabilities(Eigen::Matrix<Scalar, 25, 1> to_filter) {
-  for (size_t i = 0; i < 25; i++) {
+template <int LibrarySize>
+typename TrajectorySelector<LibrarySize>::LibraryVector TrajectorySelector<LibrarySize>::FilterSmallProbabilities(LibraryVector to_filter) {
+  for (size_t i = 0; i < to_filter.size(); i++) {
     if (to_filter(i) < 0.10) {
       to_filter(i) = 0.0;
     }
@@ -313,20 +687,12 @@ Eigen::Matrix<Scalar, 25, 1> TrajectorySelector::FilterSmallProbabilities(Eigen:
   return to_filter;
 }
 
-Eigen::Matrix<Scalar, Eigen::Dynamic, 3> TrajectorySelector::sampleTrajectoryForDrawing(size_t trajectory_index, Eigen::Matrix<Scalar, Eigen::Dynamic, 1> sampling_time_vector, size_t num_samples) {
-  Trajectory trajectory_to_sample = trajectory_library.getTrajectoryFromIndex(trajectory_index);
-  double sampling_time;
-  Eigen::Matrix<Scalar, Eigen::Dynamic, 3> sample_points_xyz_over_time(num_samples,3);
+template <int LibrarySize>
+TrajectorySamples const& TrajectorySelector<LibrarySize>::sampleTrajectoriesForDrawing(Eigen::Matrix<Scalar, Eigen::Dynamic, 1> const& sampling_time_vector) {
+  trajectory_library.getBatch().Sample(sampling_time_vector, &drawing_samples, nullptr);
+  trajectory_library.TransformSamplesIntoRDFFrame(drawing_samples);
+  return drawing_samples;
+}
 
-  for (size_t time_index = 0; time_index < num_samples; time_index++) {
-    //std::cout << "the position I sample is " << trajectory_to_sample.getPosition(sampling_time) << std::endl;
-    sampling_time = sampling_time_vector(time_index);
-    if (time_index < num_samples - 1) {
-      sample_points_xyz_over_time.row(time_index) = trajectory_to_sample.getPositionRDF(sampling_time);
-    }
-    else {
-      sample_points_xyz_over_time.row(time_index) = trajectory_to_sample.getPositionRDF(sampling_time);
-    }
-  }
-  return sample_points_xyz_over_time;
-}
\ No newline at end of file
+template class TrajectorySelector<25>;
+template class TrajectorySelector<Eigen::Dynamic>;
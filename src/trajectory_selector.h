@@ -5,10 +5,14 @@
 #include <iostream>
 #include <math.h>
 #include "trajectory_library.h"
+#include "trajectory_tree.h"
 #include "trajectory_evaluator.h"
 #include "laser_scan_collision_evaluator.h"
 #include "depth_image_collision_evaluator.h"
+#include "distance_field_collision_evaluator.h"
+#include "kd_tree_collision_evaluator.h"
 #include "value_grid_evaluator.h"
+#include "worker_pool.h"
 
 // This ROS stuff should go.  Only temporary.
 #include <nav_msgs/OccupancyGrid.h>
@@ -16,27 +20,88 @@
 #include "geometry_msgs/PoseStamped.h"
 
 #include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <vector>
 
 
+// LibrarySize fixes the number of primitives at compile time so the objective vectors live on the
+// stack and their loops unroll; Eigen::Dynamic sizes them from the library at InitializeLibrary.
+template <int LibrarySize>
 class TrajectorySelector {
 public:
 
+  typedef Eigen::Matrix<Scalar, LibrarySize, 1> LibraryVector;
+
   TrajectoryLibrary* GetTrajectoryLibraryPtr();
   ValueGridEvaluator* GetValueGridEvaluatorPtr();
   LaserScanCollisionEvaluator* GetLaserScanCollisionEvaluatorPtr();
   DepthImageCollisionEvaluator* GetDepthImageCollisionEvaluatorPtr();
+  DistanceFieldCollisionEvaluator* GetDistanceFieldCollisionEvaluatorPtr();
+  KDTreeCollisionEvaluator* GetKDTreeCollisionEvaluatorPtr();
 
   
   void InitializeLibrary(double const& final_time);
+  void InitializeLibrary(double const& final_time, size_t const& num_directions, std::vector<double> const& magnitude_fractions);
+  void InitializeLibrary3D(std::vector<double> const& final_times, size_t const& num_directions, std::vector<double> const& elevation_angles, std::vector<double> const& magnitude_fractions);
   size_t getNumTrajectories();
+
+  // Coarse-to-fine selection: refine the Euclidean choice over 2*num_directions offsets of up to radius (m/s^2)
+  // around the best and runner-up primitives
+  void setRefinement(bool const& enabled, Scalar const& radius, size_t const& num_directions);
+
+  // Accumulate collision probabilities as sums of log(1 - p), stopping each trajectory once its collision probability reaches saturation
+  void setLogDomainCollision(bool const& enabled, Scalar const& saturation);
+
+  // Threads helping the calling one with the collision, goal-progress and Dijkstra terms; results do not depend on the count
+  void setNumWorkerThreads(size_t const& num_worker_threads) {
+    worker_pool.setNumWorkers(num_worker_threads);
+  };
+
+  // Collision probabilities from the distance field, one lookup per sample, instead of depth image windows
+  void setDistanceFieldCollision(bool const& enabled) {
+    distance_field_collision = enabled;
+  };
+
+  // Depth window half-width in pixels; adaptive windows instead cover robot_radius plus num_sigmas of the
+  // projected uncertainty, up to max_block_increment
+  void setCollisionWindow(size_t const& block_increment, bool const& adaptive, Scalar const& num_sigmas, Scalar const& robot_radius, size_t const& max_block_increment) {
+    collision_block_increment = block_increment;
+    depth_image_collision_evaluator.setAdaptiveWindow(adaptive, num_sigmas, robot_radius, max_block_increment);
+  };
+
+  // Collision probabilities from a kd-tree radius search of the (possibly unorganized) cloud instead of image windows
+  void setKDTreeCollision(bool const& enabled) {
+    kd_tree_collision = enabled;
+  };
+
+  // Collision probabilities from depth-sliced C-space images of the depth frame, one pixel per sample;
+  // an empty slice_depths turns it off
+  void setInflatedCollision(Scalar const& robot_radius, std::vector<Scalar> const& slice_depths) {
+    inflated_collision = !slice_depths.empty();
+    depth_image_collision_evaluator.setInflationSlices(robot_radius, slice_depths);
+  };
+
+  // Per-tick evaluation budget in microseconds; 0 evaluates the whole library every tick
+  void setEvaluationBudget(double const& budget_microseconds);
+  size_t getNumActiveTrajectories();
+  double getLastEvaluationTime() const {
+    return last_evaluation_time;
+  }
   
+  // With refinement on, desired_acceleration may be a refined primitive's; best_traj_index is then the library
+  // primitive it was refined from
   void computeBestEuclideanTrajectory(Vector3 const& carrot_body_frame, size_t &best_traj_index, Vector3 &desired_acceleration);
   
+  // Two-segment selection over a tree whose children start from each library primitive's state at split_time
+  void InitializeTree(Scalar const& split_time);
+  void computeBestTwoSegmentTrajectory(Vector3 const& carrot_body_frame, size_t &best_traj_index, Vector3 &desired_acceleration);
+
   void computeBestDijkstraTrajectory(Vector3 const& carrot_body_frame, Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf, size_t &best_traj_index, Vector3 &desired_acceleration);
 
-  Eigen::Matrix<Scalar, Eigen::Dynamic, 3> sampleTrajectoryForDrawing(size_t trajectory_index, Eigen::Matrix<Scalar, Eigen::Dynamic, 1> sampling_time_vector, size_t num_samples);
+  TrajectorySamples const& sampleTrajectoriesForDrawing(Eigen::Matrix<Scalar, Eigen::Dynamic, 1> const& sampling_time_vector);
 
-  Eigen::Matrix<Scalar, 25, 1> getCollisionProbabilities() {
+  LibraryVector getCollisionProbabilities() {
     return collision_probabilities;
   }
 
@@ -47,29 +112,50 @@ private:
   ValueGridEvaluator value_grid_evaluator;
   LaserScanCollisionEvaluator laser_scan_collision_evaluator;
   DepthImageCollisionEvaluator depth_image_collision_evaluator;
+  DistanceFieldCollisionEvaluator distance_field_collision_evaluator;
+  KDTreeCollisionEvaluator kd_tree_collision_evaluator;
+  WorkerPool worker_pool;
 
   // For Euclidean
   void EvaluateObjectivesEuclid();
-  double EvaluateWeightedObjectiveEuclid(size_t const& trajectory_index);
+  Scalar EvaluateWeightedObjectiveEuclid(size_t const& trajectory_index);
  
   // For Dijkstra
   void EvaluateObjectivesDijkstra();
-  double EvaluateWeightedObjectiveDijkstra(size_t index);
+  Scalar EvaluateWeightedObjectiveDijkstra(size_t index);
   
   
   
 
+  void InitializeEvaluation();
+  void UpdateSamplingBases();
+
+  bool IsActive(size_t const& trajectory_index) const;
+  void FillInactiveWithActiveMinimum(Eigen::Ref<VectorX> values);
+  void UpdateEvaluationOrder();
+  void UpdateEvaluationBudget(std::chrono::high_resolution_clock::duration const& evaluation_duration);
+
   // Evaluate individual objectives
   void EvaluateDijkstraCost(Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf);
   void EvaluateGoalProgress(Vector3 const& carrot_body_frame);
   void EvaluateTerminalVelocityCost();
   void EvaluateCollisionProbabilities();
-  double computeProbabilityOfCollisionOneTrajectory(Trajectory trajectory);
+  void computeProbabilitiesOfCollision(TrajectorySamples const& collision_samples, size_t const& trajectory_stride, Eigen::Ref<VectorX> probabilities);
+  Scalar computeProbabilityOfCollisionOneTrajectory(TrajectorySamples const& collision_samples, size_t trajectory_index);
+  Scalar computeProbabilityOfCollisionOneTrajectoryLogDomain(TrajectorySamples const& collision_samples, size_t trajectory_index);
+  Scalar computeTerminalVelocityCost(Scalar const& final_trajectory_speed);
 
+  void RefineBestEuclideanTrajectory(Vector3 const& carrot_body_frame, size_t &best_traj_index, Vector3 &desired_acceleration);
 
-  Eigen::Matrix<Scalar, 25, 1> FilterSmallProbabilities(Eigen::Matrix<Scalar, 25, 1> to_filter);
-  Eigen::Matrix<Scalar, 25, 1> Normalize0to1(Eigen::Matrix<Scalar, 25, 1> cost);
-  Eigen::Matrix<Scalar, 25, 1> MakeAllGreaterThan1(Eigen::Matrix<Scalar, 25, 1> cost);
+
+  // Primitives per ParallelFor chunk for the cheap per-primitive terms; small libraries stay on the calling thread
+  static const size_t primitive_chunk_size = 64;
+
+  LibraryVector FilterSmallProbabilities(LibraryVector to_filter);
+  template <typename CostVector>
+  CostVector Normalize0to1(CostVector cost);
+  template <typename CostVector>
+  CostVector MakeAllGreaterThan1(CostVector cost);
   
   
 
@@ -81,19 +167,80 @@ private:
   Eigen::Matrix<Scalar, 20, 1> collision_sampling_time_vector;
   size_t num_samples_collision = collision_sampling_time_vector.size();
 
-  Eigen::Matrix<Scalar, 25, 1> dijkstra_evaluations;
-  Eigen::Matrix<Scalar, 25, 1> goal_progress_evaluations;
-  Eigen::Matrix<Scalar, 25, 1> terminal_velocity_evaluations;
-  Eigen::Matrix<Scalar, 25, 1> collision_probabilities;
-  Eigen::Matrix<Scalar, 25, 1> no_collision_probabilities;
+  // Rebuilt only when final_time or the jerk time changes
+  TrajectoryBasis sampling_basis;
+  TrajectoryBasis collision_sampling_basis;
+  TrajectoryBasis terminal_velocity_basis;
+  Scalar terminal_velocity_time = 0.5;
+
+  // Batched samples of the whole library, refilled each tick
+  TrajectorySamples dijkstra_samples;
+  TrajectorySamples collision_samples;
+  TrajectorySamples terminal_velocity_samples;
+  TrajectorySamples drawing_samples;
+  ArrayX3 terminal_stop_positions;
 
-  Eigen::Matrix<Scalar, 25, 1> objectives_dijkstra;
-  Eigen::Matrix<Scalar, 25, 1> objectives_euclid;
+  LibraryVector dijkstra_evaluations;
+  LibraryVector goal_progress_evaluations;
+  LibraryVector terminal_velocity_evaluations;
+  LibraryVector collision_probabilities;
+  LibraryVector no_collision_probabilities;
+
+  LibraryVector objectives_dijkstra;
+  LibraryVector objectives_euclid;
 
   double soft_top_speed = 5.0;
 
+  double evaluation_budget = 0;
+  double evaluation_time_per_trajectory = 0;
+  double last_evaluation_time = 0;
+  double min_evaluation_time_per_trajectory = 0.01;
+  // Library indices ordered so that every prefix spreads over headings and magnitudes; under a budget only the
+  // first num_active_trajectories are evaluated, gathered into a dense batch for the collision evaluators
+  std::vector<size_t> evaluation_order;
+  std::vector<size_t> evaluation_rank;
+  size_t num_active_trajectories = 0;
+  TrajectorySamples active_collision_samples;
+  VectorX active_collision_probabilities;
+
+  size_t collision_block_increment = 10;
+  bool distance_field_collision = false;
+  bool kd_tree_collision = false;
+  bool inflated_collision = false;
+  bool log_domain_collision = false;
+  Scalar collision_saturation = 0.99;
+
+  bool refinement_enabled = false;
+  Scalar refinement_radius = 1.0;
+  size_t refinement_num_directions = 8;
+  TrajectoryBasis refinement_collision_basis;
+  TrajectorySamples refinement_samples;
+  VectorX refinement_no_collision_probabilities;
+  VectorX refinement_objectives;
+  // Scale of the last coarse Euclidean objectives, so refined candidates are scored on it
+  Scalar euclid_weighted_min = 0;
+  Scalar no_collision_min = 0;
+  Scalar no_collision_max = 0;
+
+  TrajectoryTree trajectory_tree;
+  TrajectoryBasis tree_root_basis;
+  TrajectoryBasis tree_child_basis;
+  TrajectoryBasis tree_child_velocity_basis;
+  // The terminal velocity term is read from the roots when the split comes after terminal_velocity_time
+  bool tree_terminal_velocity_on_roots = false;
+  VectorX tree_root_terminal_velocity_costs;
+  TrajectorySamples tree_root_samples;
+  TrajectorySamples tree_child_samples;
+  VectorX tree_root_collision_probabilities;
+  VectorX tree_child_collision_probabilities;
+  VectorX tree_no_collision_probabilities;
+  VectorX tree_objectives;
+
 
 
 };
 
+// Default 1 + 3x8 primitive library
+typedef TrajectorySelector<25> TrajectorySelector2D;
+
 #endif
\ No newline at end of file
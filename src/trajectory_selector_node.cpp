@@ -2,6 +2,8 @@
 #include <nav_msgs/Path.h>
 #include <visualization_msgs/Marker.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
 #include <nav_msgs/Odometry.h>
 //#include <geometry_msgs/PoseWithCovarianceStamped.h>
 //#include <geometry_msgs/TwistWithCovarianceStamped.h>
@@ -24,13 +26,17 @@
 #include <time.h>
 #include <stdlib.h>
 #include <chrono>
+#include <limits>
 
 #include "trajectory_selector.h"
+#include "point_cloud_preprocessor.h"
 #include "attitude_generator.h"
 #include "trajectory_visualizer.h"
 
 #include <quad_msgs/AttitudeYawRateCommand.h>
 
+// LibrarySize is the selector's: 25 for the default 2D library, Eigen::Dynamic for the 3D one
+template <int LibrarySize>
 class TrajectorySelectorNode {
 public:
 
@@ -41,10 +47,14 @@ public:
 		//pose_sub = nh.subscribe("/hummingbird/ground_truth/pose", 1, &TrajectorySelectorNode::OnPose, this);
 		//velocity_sub = nh.subscribe("/hummingbird/ground_truth/odometry/twist", 1, &TrajectorySelectorNode::OnVelocity, this);
 		//waypoints_sub = nh.subscribe("/waypoint_list", 1, &TrajectorySelectorNode::OnWaypoints, this);
-  	    //depth_image_sub = nh.subscribe("/flight/xtion_depth/points", 1, &TrajectorySelectorNode::OnDepthImage, this);
   	    global_goal_sub = nh.subscribe("/move_base_simple/goal", 1, &TrajectorySelectorNode::OnGlobalGoal, this);
   	    //value_grid_sub = nh.subscribe("/value_grid", 1, &TrajectorySelectorNode::OnValueGrid, this);
-  	    laser_scan_sub = nh.subscribe("/hummingbird/vi_sensor/camera_depth/depth/points", 1, &TrajectorySelectorNode::OnScan, this);
+  	    // Raw depth images straight into the depth image evaluator, back-projected with depth_camera/K.
+  	    // The cloud is then only subscribed for the cloud-based evaluators, below.
+  	    nh.param("depth_image_input", depth_image_input, false);
+  	    if (depth_image_input) {
+  	    	raw_depth_image_sub = nh.subscribe("/hummingbird/vi_sensor/camera_depth/depth/image_raw", 1, &TrajectorySelectorNode::OnRawDepthImage, this);
+  	    }
 
   	    // Publishers
 		carrot_pub = nh.advertise<visualization_msgs::Marker>( "carrot_marker", 0 );
@@ -54,7 +64,74 @@ public:
 		//attitude_setpoint_visualization_pub = nh.advertise<geometry_msgs::PoseStamped>("attitude_setpoint", 1);
 
 		// Initialization
-		trajectory_selector.InitializeLibrary(final_time);
+		bool library_3d;
+		nh.param("library_3d", library_3d, false);
+		if (library_3d) {
+			std::vector<double> final_times;
+			int num_directions;
+			std::vector<double> elevation_angles;
+			std::vector<double> magnitude_fractions;
+			nh.param("library_3d_final_times", final_times, std::vector<double>(1, final_time));
+			nh.param("library_3d_num_directions", num_directions, 8);
+			nh.param("library_3d_elevation_angles", elevation_angles, std::vector<double>({-0.3, 0.0, 0.3}));
+			nh.param("library_3d_magnitude_fractions", magnitude_fractions, std::vector<double>({1.0, 0.6, 0.15}));
+			trajectory_selector.InitializeLibrary3D(final_times, num_directions, elevation_angles, magnitude_fractions);
+		}
+		else {
+			trajectory_selector.InitializeLibrary(final_time);
+		}
+		int num_worker_threads;
+		nh.param("num_worker_threads", num_worker_threads, 0);
+		trajectory_selector.setNumWorkerThreads(num_worker_threads);
+		double evaluation_budget_us;
+		nh.param("evaluation_budget_us", evaluation_budget_us, 0.0);
+		trajectory_selector.setEvaluationBudget(evaluation_budget_us);
+		bool refine_selection;
+		nh.param("refine_selection", refine_selection, false);
+		trajectory_selector.setRefinement(refine_selection, 1.0, 8);
+		nh.param("use_two_segment_tree", use_two_segment_tree, false);
+		if (use_two_segment_tree) {
+			trajectory_selector.InitializeTree(0.5*final_time);
+		}
+		bool distance_field_collision;
+		nh.param("distance_field_collision", distance_field_collision, false);
+		trajectory_selector.setDistanceFieldCollision(distance_field_collision);
+		int collision_window;
+		bool adaptive_collision_window;
+		double adaptive_collision_window_sigmas;
+		double adaptive_collision_window_robot_radius;
+		int adaptive_collision_window_max;
+		nh.param("collision_window", collision_window, 10);
+		nh.param("adaptive_collision_window", adaptive_collision_window, false);
+		nh.param("adaptive_collision_window_sigmas", adaptive_collision_window_sigmas, 3.0);
+		nh.param("adaptive_collision_window_robot_radius", adaptive_collision_window_robot_radius, 0.4);
+		nh.param("adaptive_collision_window_max", adaptive_collision_window_max, 40);
+		trajectory_selector.setCollisionWindow(collision_window, adaptive_collision_window, adaptive_collision_window_sigmas,
+			adaptive_collision_window_robot_radius, adaptive_collision_window_max);
+		bool kd_tree_collision;
+		nh.param("kd_tree_collision", kd_tree_collision, false);
+		trajectory_selector.setKDTreeCollision(kd_tree_collision);
+		if (!depth_image_input || distance_field_collision || kd_tree_collision) {
+			depth_image_sub = nh.subscribe("/hummingbird/vi_sensor/camera_depth/depth/points", 1, &TrajectorySelectorNode::OnDepthImage, this);
+		}
+		bool inflated_collision;
+		nh.param("inflated_collision", inflated_collision, false);
+		if (inflated_collision) {
+			trajectory_selector.setInflatedCollision(0.4, {0.5, 0.75, 1.0, 1.5, 2.0, 3.0, 4.0, 6.0, 8.0});
+		}
+		bool log_domain_collision;
+		double collision_saturation;
+		nh.param("log_domain_collision", log_domain_collision, false);
+		nh.param("collision_saturation", collision_saturation, 0.99);
+		trajectory_selector.setLogDomainCollision(log_domain_collision, collision_saturation);
+		bool use_terminal_stop_table;
+		nh.param("use_terminal_stop_table", use_terminal_stop_table, false);
+		if (use_terminal_stop_table) {
+			trajectory_selector.GetTrajectoryLibraryPtr()->BuildTerminalStopTable(8.0, 32, 0.05);
+		}
+
+		SetDepthCameraModel();
+		SetPreprocessing();
 
 		trajectory_visualizer.initialize(&trajectory_selector, nh, &best_traj_index, final_time);
 		tf_listener_ = std::make_shared<tf2_ros::TransformListener>(tf_buffer_);
@@ -90,13 +167,19 @@ public:
 		//SetGoalFromBearing();
 		
 		auto t1 = std::chrono::high_resolution_clock::now();
-		trajectory_selector.computeBestEuclideanTrajectory(carrot_ortho_body_frame, best_traj_index, desired_acceleration);
+		if (use_two_segment_tree) {
+			trajectory_selector.computeBestTwoSegmentTrajectory(carrot_ortho_body_frame, best_traj_index, desired_acceleration);
+		}
+		else {
+			trajectory_selector.computeBestEuclideanTrajectory(carrot_ortho_body_frame, best_traj_index, desired_acceleration);
+		}
 		auto t2 = std::chrono::high_resolution_clock::now();
 		std::cout << "Computing best traj took "
     	  << std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count()
-      		<< " microseconds\n"; 
+      		<< " microseconds, evaluated " << trajectory_selector.getNumActiveTrajectories()
+      		<< " of " << trajectory_selector.getNumTrajectories() << " trajectories\n"; 
 
-      	Eigen::Matrix<Scalar, 25, 1> collision_probabilities = trajectory_selector.getCollisionProbabilities();
+      	typename TrajectorySelector<LibrarySize>::LibraryVector collision_probabilities = trajectory_selector.getCollisionProbabilities();
 		trajectory_visualizer.setCollisionProbabilities(collision_probabilities);
 
 		Vector3 attitude_thrust_desired = attitude_generator.generateDesiredAttitudeThrust(desired_acceleration);
@@ -108,6 +191,38 @@ public:
 
 private:
 
+	// Same fields as the depth camera's sensor_msgs/CameraInfo; defaults are the simulated 160x120 sensor
+	void SetDepthCameraModel() {
+		int width, height, pyramid_level;
+		std::vector<double> K;
+		std::vector<double> default_K = {142.58555603027344, 0.0, 79.5, 0.0, 142.58555603027344, 59.5, 0.0, 0.0, 1.0};
+		nh.param("depth_camera/width", width, 160);
+		nh.param("depth_camera/height", height, 120);
+		nh.param("depth_camera/K", K, default_K);
+		nh.param("depth_camera/pyramid_level", pyramid_level, 0);
+		if (K.size() != 9) {
+			ROS_ERROR("depth_camera/K must have 9 entries, keeping the default camera model");
+			return;
+		}
+		Matrix3 sensor_K;
+		sensor_K << K[0], K[1], K[2], K[3], K[4], K[5], K[6], K[7], K[8];
+		trajectory_selector.GetDepthImageCollisionEvaluatorPtr()->setCameraModel(sensor_K, width, height, pyramid_level);
+	}
+
+	void SetPreprocessing() {
+		double min_range, max_range, voxel_size, ground_tolerance, ground_max_tilt;
+		bool ground_removal;
+		nh.param("preprocess/min_range", min_range, 0.0);
+		nh.param("preprocess/max_range", max_range, std::numeric_limits<double>::infinity());
+		nh.param("preprocess/voxel_size", voxel_size, 0.0);
+		nh.param("preprocess/ground_removal", ground_removal, false);
+		nh.param("preprocess/ground_tolerance", ground_tolerance, 0.1);
+		nh.param("preprocess/ground_max_tilt", ground_max_tilt, 0.35);
+		depth_preprocessor.setRangeLimits(min_range, max_range);
+		depth_preprocessor.setVoxelSize(voxel_size);
+		depth_preprocessor.setGroundRemoval(ground_removal, ground_tolerance, ground_max_tilt);
+	}
+
 	void SetGoalFromBearing() {
 		bool go;
 		nh.param("go", go, false);
@@ -169,13 +284,22 @@ private:
 		attitude_generator.UpdateRollPitch(roll, pitch);
 	}
 
-	void UpdateLaserRDFFramesFromPose() {
-		transformAccelerationsIntoLaserRDFFrames();
+	void UpdateRDFTransformFromPose() {
+		geometry_msgs::TransformStamped tf;
+		try {
+			tf = tf_buffer_.lookupTransform("hummingbird/vi_sensor/camera_depth_optical_center_link", "hummingbird/ortho_base_link", 
+                                    ros::Time(0), ros::Duration(1/30.0));
+		} catch (tf2::TransformException &ex) {
+			ROS_ERROR("%s", ex.what());
+			return;
+		}
+
+		Eigen::Quaternion<Scalar> quat(tf.transform.rotation.w, tf.transform.rotation.x, tf.transform.rotation.y, tf.transform.rotation.z);
+		Vector3 translation(tf.transform.translation.x, tf.transform.translation.y, tf.transform.translation.z);
+
 		TrajectoryLibrary* trajectory_library_ptr = trajectory_selector.GetTrajectoryLibraryPtr();
-		Vector3 initial_acceleration = trajectory_library_ptr->getInitialAcceleration();
-    	if (trajectory_library_ptr != nullptr) {
-			trajectory_library_ptr->setInitialAccelerationLASER(transformOrthoBodyIntoLaserFrame(initial_acceleration));
-			trajectory_library_ptr->setInitialAccelerationRDF(transformOrthoBodyIntoRDFFrame(initial_acceleration));
+		if (trajectory_library_ptr != nullptr) {
+			trajectory_library_ptr->setRDFTransform(quat.toRotationMatrix(), translation);
 		}
 	}
 
@@ -199,61 +323,7 @@ private:
 		UpdateAttitudeGeneratorRollPitch(roll, pitch);
 		PublishOrthoBodyTransform(roll, pitch);
 		UpdateCarrotOrthoBodyFrame();
-		UpdateLaserRDFFramesFromPose();
-	}
-
-	void transformAccelerationsIntoLaserRDFFrames() {
-		TrajectoryLibrary* trajectory_library_ptr = trajectory_selector.GetTrajectoryLibraryPtr();
-		if (trajectory_library_ptr != nullptr) {
-
-			std::vector<Trajectory>::iterator trajectory_iterator_begin = trajectory_library_ptr->GetTrajectoryNonConstIteratorBegin();
-	  		std::vector<Trajectory>::iterator trajectory_iterator_end = trajectory_library_ptr->GetTrajectoryNonConstIteratorEnd();
-
-	  		Vector3 acceleration_ortho_body;
-			Vector3 acceleration_laser_frame;
-			Vector3 acceleration_rdf_frame;
-
-
-	  		for (auto trajectory = trajectory_iterator_begin; trajectory != trajectory_iterator_end; trajectory++) {
-	  			acceleration_ortho_body = trajectory->getAcceleration();
-
-	  			acceleration_laser_frame = transformOrthoBodyIntoLaserFrame(acceleration_ortho_body);
-	  			trajectory->setAccelerationLASER(acceleration_laser_frame);
-
-	  			acceleration_rdf_frame = transformOrthoBodyIntoRDFFrame(acceleration_ortho_body);
-	  			trajectory->setAccelerationRDF(acceleration_rdf_frame);
-	  		} 
-	  	}
-	}
-
-	Vector3 transformOrthoBodyIntoLaserFrame(Vector3 const& ortho_body_vector) {
-		geometry_msgs::TransformStamped tf;
-    	try {
-     		tf = tf_buffer_.lookupTransform("hummingbird/vi_sensor/camera_depth_optical_center_link", "hummingbird/ortho_base_link", 
-                                    ros::Time(0), ros::Duration(1/30.0));
-   		} catch (tf2::TransformException &ex) {
-     	 	ROS_ERROR("%s", ex.what());
-      	return Vector3(0,0,0);
-    	}
-    	geometry_msgs::PoseStamped pose_ortho_body_vector = PoseFromVector3(ortho_body_vector, "hummingbird/ortho_base_link");
-    	geometry_msgs::PoseStamped pose_vector_laser_frame = PoseFromVector3(Vector3(0,0,0), "hummingbird/vi_sensor/camera_depth_optical_center_link");
-    	tf2::doTransform(pose_ortho_body_vector, pose_vector_laser_frame, tf);
-    	return VectorFromPose(pose_vector_laser_frame);
-	}
-
-	Vector3 transformOrthoBodyIntoRDFFrame(Vector3 const& ortho_body_vector) {
-		geometry_msgs::TransformStamped tf;
-    	try {
-     		tf = tf_buffer_.lookupTransform("hummingbird/vi_sensor/camera_depth_optical_center_link", "hummingbird/ortho_base_link", 
-                                    ros::Time(0), ros::Duration(1/30.0));
-   		} catch (tf2::TransformException &ex) {
-     	 	ROS_ERROR("%s", ex.what());
-      	return Vector3(0,0,0);
-    	}
-    	geometry_msgs::PoseStamped pose_ortho_body_vector = PoseFromVector3(ortho_body_vector, "hummingbird/ortho_base_link");
-    	geometry_msgs::PoseStamped pose_vector_rdf_frame = PoseFromVector3(Vector3(0,0,0), "hummingbird/vi_sensor/camera_depth_optical_center_link");
-    	tf2::doTransform(pose_ortho_body_vector, pose_vector_rdf_frame, tf);
-    	return VectorFromPose(pose_vector_rdf_frame);
+		UpdateRDFTransformFromPose();
 	}
 
 	Vector3 TransformWorldToOrthoBody(Vector3 const& world_frame) {
@@ -275,8 +345,6 @@ private:
 		TrajectoryLibrary* trajectory_library_ptr = trajectory_selector.GetTrajectoryLibraryPtr();
 		if (trajectory_library_ptr != nullptr) {
 			trajectory_library_ptr->setInitialVelocity(velocity_ortho_body_frame);
-			trajectory_library_ptr->setInitialVelocityLASER(transformOrthoBodyIntoLaserFrame(velocity_ortho_body_frame));
-			trajectory_library_ptr->setInitialVelocityRDF(transformOrthoBodyIntoRDFFrame(velocity_ortho_body_frame));
 		}
 	}
 
@@ -294,23 +362,6 @@ private:
 		UpdateCarrotOrthoBodyFrame();
 	}
 
-	void OnScan(sensor_msgs::PointCloud2 const& laser_point_cloud_msg) {
-		ROS_INFO("GOT SCAN");
-		LaserScanCollisionEvaluator* laser_scan_collision_ptr = trajectory_selector.GetLaserScanCollisionEvaluatorPtr();
-
-		if (laser_scan_collision_ptr != nullptr) {
-			
-			pcl::PCLPointCloud2* cloud = new pcl::PCLPointCloud2; 
-			pcl::PCLPointCloud2ConstPtr cloudPtr(cloud);
-			
-			pcl_conversions::toPCL(laser_point_cloud_msg, *cloud);
-			pcl::PointCloud<pcl::PointXYZ>::Ptr xyz_cloud = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>);
-			pcl::fromPCLPointCloud2(*cloud,*xyz_cloud);
-
-			laser_scan_collision_ptr->UpdatePointCloudPtr(xyz_cloud);
-		}
-	}
-
 	void UpdateValueGrid(nav_msgs::OccupancyGrid value_grid_msg) {
 		auto t1 = std::chrono::high_resolution_clock::now();
 
@@ -353,8 +404,8 @@ private:
 		double distance_so_far = 0.0;
 		double distance_to_add;
 		double distance_left;
-		Eigen::Vector3d truncated_waypoint;
-		Eigen::Vector3d p1, p2;
+		Vector3 truncated_waypoint;
+		Vector3 p1, p2;
 		int i;
 		for (i = 0; i < waypoints_to_check - 1; i++){
 			p1 = VectorFromPose(waypoints.poses[i]);
@@ -439,13 +490,43 @@ private:
 	    	pcl::PointCloud<pcl::PointXYZ>::Ptr xyz_cloud(new pcl::PointCloud<pcl::PointXYZ>);
 	    	pcl::fromPCLPointCloud2(*cloud,*xyz_cloud);
 
-			depth_image_collision_ptr->UpdatePointCloudPtr(xyz_cloud);
+			// The depth image evaluator needs the organized cloud, unless it reads raw depth images;
+			// the others share the downsampled one, so the cloud is converted and preprocessed once
+			depth_preprocessor.Process(xyz_cloud);
+			if (!depth_image_input) {
+				depth_image_collision_ptr->UpdatePointCloudPtr(xyz_cloud);
+			}
+			trajectory_selector.GetLaserScanCollisionEvaluatorPtr()->UpdatePointCloudPtr(depth_preprocessor.getDownsampledCloud());
+			trajectory_selector.GetDistanceFieldCollisionEvaluatorPtr()->UpdatePointCloudPtr(depth_preprocessor.getDownsampledCloud());
+			trajectory_selector.GetKDTreeCollisionEvaluatorPtr()->UpdatePointCloudPtr(depth_preprocessor.getDownsampledCloud());
 		}
 	
 	}
 
 	
 
+	// 16UC1 is in millimetres, 32FC1 in metres. The image skips the preprocessing stage, which only sees the cloud.
+	void OnRawDepthImage(const sensor_msgs::ImageConstPtr& depth_image_msg) {
+		ROS_INFO("GOT DEPTH IMAGE");
+		DepthImageCollisionEvaluator* depth_image_collision_ptr = trajectory_selector.GetDepthImageCollisionEvaluatorPtr();
+
+		if (depth_image_collision_ptr != nullptr) {
+			if (depth_image_msg->is_bigendian) {
+				ROS_ERROR("Big-endian depth images are not supported");
+				return;
+			}
+			if (depth_image_msg->encoding == sensor_msgs::image_encodings::TYPE_16UC1) {
+				depth_image_collision_ptr->UpdateDepthImage(reinterpret_cast<uint16_t const*>(depth_image_msg->data.data()), depth_image_msg->width, depth_image_msg->height, depth_image_msg->step, 0.001);
+			}
+			else if (depth_image_msg->encoding == sensor_msgs::image_encodings::TYPE_32FC1) {
+				depth_image_collision_ptr->UpdateDepthImage(reinterpret_cast<float const*>(depth_image_msg->data.data()), depth_image_msg->width, depth_image_msg->height, depth_image_msg->step, 1.0);
+			}
+			else {
+				ROS_ERROR("Unsupported depth image encoding %s", depth_image_msg->encoding.c_str());
+			}
+		}
+	}
+
 	void PublishAttitudeSetpoint(Vector3 const& roll_pitch_thrust) { 
 
     /*
@@ -517,9 +598,9 @@ private:
 	ros::Subscriber pose_sub;
 	ros::Subscriber velocity_sub;
 	ros::Subscriber depth_image_sub;
+	ros::Subscriber raw_depth_image_sub;
 	ros::Subscriber global_goal_sub;
 	ros::Subscriber value_grid_sub;
-	ros::Subscriber laser_scan_sub;
 
 	ros::Publisher carrot_pub;
 	ros::Publisher gaussian_pub;
@@ -538,9 +619,11 @@ private:
 
 	double start_time = 0.0;
 	double final_time = 1.0;
+	bool use_two_segment_tree = false;
+	bool depth_image_input = false;
 
 	Eigen::Vector4d pose_x_y_z_yaw;
-	Eigen::Matrix<double, 4, Eigen::Dynamic> waypoints_matrix;
+	Eigen::Matrix<Scalar, 4, Eigen::Dynamic> waypoints_matrix;
 
 	Eigen::Matrix<Scalar, Eigen::Dynamic, 1> sampling_time_vector;
 	size_t num_samples;
@@ -552,24 +635,22 @@ private:
 
 	size_t best_traj_index = 0;
 
-	TrajectorySelector trajectory_selector;
+	TrajectorySelector<LibrarySize> trajectory_selector;
+	PointCloudPreprocessor depth_preprocessor;
 	AttitudeGenerator attitude_generator;
 
 
 	ros::NodeHandle nh;
 
 public:
-	TrajectoryVisualizer trajectory_visualizer;
+	TrajectoryVisualizer<LibrarySize> trajectory_visualizer;
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
 
 
-int main(int argc, char* argv[]) {
-	std::cout << "Initializing trajectory_selector_node" << std::endl;
-
-	ros::init(argc, argv, "TrajectorySelectorNode");
-
-	TrajectorySelectorNode trajectory_selector_node;
+template <int LibrarySize>
+void Run() {
+	TrajectorySelectorNode<LibrarySize> trajectory_selector_node;
 
 	std::cout << "Got through to here" << std::endl;
 	ros::Rate spin_rate(100);
@@ -592,3 +673,19 @@ int main(int argc, char* argv[]) {
 		spin_rate.sleep();
 	}
 }
+
+int main(int argc, char* argv[]) {
+	std::cout << "Initializing trajectory_selector_node" << std::endl;
+
+	ros::init(argc, argv, "TrajectorySelectorNode");
+
+	// The 3D library's size depends on its parameters, so it needs the dynamically sized selector
+	bool library_3d;
+	ros::NodeHandle().param("library_3d", library_3d, false);
+	if (library_3d) {
+		Run<Eigen::Dynamic>();
+	}
+	else {
+		Run<25>();
+	}
+}
@@ -10,10 +10,10 @@ geometry_msgs::PoseStamped PoseFromVector3(Vector3 const& position, std::string
 	return pose;
 }
 
-Eigen::Vector3d VectorFromPose(geometry_msgs::PoseStamped const& pose) {
+Vector3 VectorFromPose(geometry_msgs::PoseStamped const& pose) {
 	return Vector3(pose.pose.position.x, pose.pose.position.y, pose.pose.position.z);
 }
 
-Eigen::Vector3d VectorFromPoseUnstamped(geometry_msgs::Pose const& pose) {
+Vector3 VectorFromPoseUnstamped(geometry_msgs::Pose const& pose) {
 	return Vector3(pose.position.x, pose.position.y, pose.position.z);
 }
\ No newline at end of file
@@ -5,7 +5,7 @@
 #include "geometry_msgs/PoseStamped.h"
 
 geometry_msgs::PoseStamped PoseFromVector3(Vector3 const& position, std::string const& frame);
-Eigen::Vector3d VectorFromPose(geometry_msgs::PoseStamped const& pose);
-Eigen::Vector3d VectorFromPoseUnstamped(geometry_msgs::Pose const& pose);
+Vector3 VectorFromPose(geometry_msgs::PoseStamped const& pose);
+Vector3 VectorFromPoseUnstamped(geometry_msgs::Pose const& pose);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "trajectory_tree.h"
+
+void TrajectoryTree::Initialize(TrajectoryBatch const& root_batch, Scalar const& split_time) {
+  this->root_batch = &root_batch;
+  this->split_time = split_time;
+  size_t num_roots = root_batch.getNumTrajectories();
+
+  split_basis.Build(Vector1(split_time), root_batch.getJerkTime(), root_batch.getHorizonScales());
+
+  child_states.clear();
+  child_batches.resize(num_roots);
+  split_positions.assign(num_roots, Vector3(0,0,0));
+  for (size_t root = 0; root < num_roots; root++) {
+    child_states.push_back(std::make_shared<TrajectoryInitialState>());
+    child_batches[root].resize(num_roots);
+    child_batches[root].setAccelerationMax(root_batch.getAccelerationMax());
+    child_batches[root].setInitialState(child_states[root]);
+    for (size_t child = 0; child < num_roots; child++) {
+      child_batches[root].setAcceleration(child, root_batch.getAcceleration(child));
+    }
+  }
+  UpdateChildStates();
+};
+
+void TrajectoryTree::UpdateChildStates() {
+  root_batch->Sample(split_basis, &split_position_samples, &split_velocity_samples);
+
+  // Acceleration is still ramping toward the root's if the split falls inside the jerk time
+  Scalar jerk_time = root_batch->getJerkTime();
+  Scalar ramp = std::min(split_time / jerk_time, (Scalar) 1.0);
+  Vector3 initial_acceleration = root_batch->getInitialAcceleration();
+
+  for (size_t root = 0; root < child_batches.size(); root++) {
+    split_positions[root] = split_position_samples.getSample(root, 0);
+    child_states[root]->setInitialVelocity(split_velocity_samples.getSample(root, 0));
+    child_states[root]->setInitialAcceleration(initial_acceleration + ramp*(root_batch->getAcceleration(root) - initial_acceleration));
+  }
+};
+
+void TrajectoryTree::SampleChildren(size_t root_index, TrajectoryBasis const& basis, TrajectorySamples* positions, TrajectorySamples* velocities) const {
+  child_batches[root_index].Sample(basis, positions, velocities);
+  if (positions != nullptr) {
+    positions->Translate(split_positions[root_index]);
+  }
+};
+
+void TrajectoryTree::SampleChildTerminalStopPositions(size_t root_index, Scalar const& t, ArrayX3 &terminal_stop_positions) const {
+  child_batches[root_index].SampleTerminalStopPositions(t, terminal_stop_positions);
+  terminal_stop_positions.rowwise() += split_positions[root_index].transpose().array();
+};
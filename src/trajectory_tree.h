@@ -0,0 +1,53 @@
+#ifndef TRAJECTORY_TREE_H
+#define TRAJECTORY_TREE_H
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "trajectory.h"
+#include "trajectory_batch.h"
+
+// Two-segment library organized as a tree of shared prefixes.
+// Every root primitive is followed, from its state at split_time, by one child per root acceleration,
+// so a root's prefix is shared by all of its children and only needs evaluating once.
+class TrajectoryTree {
+public:
+
+  void Initialize(TrajectoryBatch const& root_batch, Scalar const& split_time);
+  bool isInitialized() const {
+    return root_batch != nullptr;
+  };
+
+  // Propagates the roots' current initial state to the start of every child segment; O(roots)
+  void UpdateChildStates();
+
+  size_t getNumRoots() const {
+    return child_batches.size();
+  };
+  size_t getNumChildren() const {
+    return root_batch->getNumTrajectories();
+  };
+  Scalar getSplitTime() const {
+    return split_time;
+  };
+
+  // Children of one root, with times measured from split_time and positions in the roots' frame
+  void SampleChildren(size_t root_index, TrajectoryBasis const& basis, TrajectorySamples* positions, TrajectorySamples* velocities) const;
+  void SampleChildTerminalStopPositions(size_t root_index, Scalar const& t, ArrayX3 &terminal_stop_positions) const;
+
+private:
+
+  TrajectoryBatch const* root_batch = nullptr;
+  Scalar split_time = 0;
+
+  std::vector<std::shared_ptr<TrajectoryInitialState> > child_states;
+  std::vector<TrajectoryBatch> child_batches;
+  std::vector<Vector3> split_positions;
+
+  TrajectoryBasis split_basis;
+  TrajectorySamples split_position_samples;
+  TrajectorySamples split_velocity_samples;
+
+};
+
+#endif
@@ -1,20 +1,23 @@
 #include "trajectory_visualizer.h"
 
 
-void TrajectoryVisualizer::TestVisualizer() {
+template <int LibrarySize>
+void TrajectoryVisualizer<LibrarySize>::TestVisualizer() {
 
   std::cout << "Printing from inside TrajectoryVisualizer " << std::endl;  
 
 }
 
 
-void TrajectoryVisualizer::initializeDrawingPaths() {
+template <int LibrarySize>
+void TrajectoryVisualizer<LibrarySize>::initializeDrawingPaths() {
 	for (int i = 0; i < trajectory_selector->getNumTrajectories(); i++) {
 		action_paths_pubs.push_back(nh.advertise<nav_msgs::Path>("/poly_samples"+std::to_string(i), 1));
 	}
 }
 
-void TrajectoryVisualizer::createSamplingTimeVector() {
+template <int LibrarySize>
+void TrajectoryVisualizer<LibrarySize>::createSamplingTimeVector() {
 	num_samples = 10;
 	sampling_time_vector.resize(num_samples, 1);
 
@@ -27,7 +30,8 @@ void TrajectoryVisualizer::createSamplingTimeVector() {
 }
 
 
-void TrajectoryVisualizer::drawGaussianPropagation(int id, Vector3 position, Vector3 sigma) {
+template <int LibrarySize>
+void TrajectoryVisualizer<LibrarySize>::drawGaussianPropagation(int id, Vector3 position, Vector3 sigma) {
 	visualization_msgs::Marker marker;
 	marker.header.frame_id = drawing_frame;
 	marker.header.stamp = ros::Time::now();
@@ -48,11 +52,12 @@ void TrajectoryVisualizer::drawGaussianPropagation(int id, Vector3 position, Vec
 	gaussian_pub.publish( marker );
 }
 
-void TrajectoryVisualizer::NormalizeCollisions() {
+template <int LibrarySize>
+void TrajectoryVisualizer<LibrarySize>::NormalizeCollisions() {
 	double max = collision_probabilities(0);
 	double min = collision_probabilities(0);
 	double current;
-	for (int i = 1; i < 25; i++) {
+	for (int i = 1; i < collision_probabilities.size(); i++) {
 		current = collision_probabilities(i);
 		if (current > max) {
 			max = current;
@@ -67,13 +72,14 @@ void TrajectoryVisualizer::NormalizeCollisions() {
 		return;
 	};
 
-	for (int i = 0; i < 25; i++) {
+	for (int i = 0; i < collision_probabilities.size(); i++) {
 		normalized_collision_probabilities(i) = (collision_probabilities(i) - min) / (max - min);
 	}
 }
 
 
-void TrajectoryVisualizer::drawCollisionIndicator(int const& id, Vector3 const& position, double const& collision_prob) {
+template <int LibrarySize>
+void TrajectoryVisualizer<LibrarySize>::drawCollisionIndicator(int const& id, Vector3 const& position, double const& collision_prob) {
 	NormalizeCollisions();
 
 	visualization_msgs::Marker marker;
@@ -103,7 +109,8 @@ void TrajectoryVisualizer::drawCollisionIndicator(int const& id, Vector3 const&
 	gaussian_pub.publish( marker );
 }
 
-void TrajectoryVisualizer::drawFinalStoppingPosition(int id, Vector3 position) {
+template <int LibrarySize>
+void TrajectoryVisualizer<LibrarySize>::drawFinalStoppingPosition(int id, Vector3 position) {
 	visualization_msgs::Marker marker;
 	marker.header.frame_id = drawing_frame;
 	marker.header.stamp = ros::Time::now();
@@ -124,7 +131,8 @@ void TrajectoryVisualizer::drawFinalStoppingPosition(int id, Vector3 position) {
 	gaussian_pub.publish( marker );
 }
 
-void TrajectoryVisualizer::drawDebugPoints() {
+template <int LibrarySize>
+void TrajectoryVisualizer<LibrarySize>::drawDebugPoints() {
 	LaserScanCollisionEvaluator* laser_scan_collision_ptr = trajectory_selector->GetLaserScanCollisionEvaluatorPtr();
 	if (laser_scan_collision_ptr != nullptr) {
 		Eigen::Matrix<Scalar, 100, 3> points = laser_scan_collision_ptr->DebugPointsToDraw();
@@ -155,33 +163,36 @@ void TrajectoryVisualizer::drawDebugPoints() {
 
 
 
-void TrajectoryVisualizer::drawAll() {
+template <int LibrarySize>
+void TrajectoryVisualizer<LibrarySize>::drawAll() {
 	//drawDebugPoints();
 	size_t num_trajectories = trajectory_selector->getNumTrajectories(); 
 	TrajectoryLibrary* trajectory_library_ptr = trajectory_selector->GetTrajectoryLibraryPtr();
+	TrajectorySamples const& sample_points_xyz_over_time = trajectory_selector->sampleTrajectoriesForDrawing(sampling_time_vector);
 
 
 	for (size_t trajectory_index = 0; trajectory_index < num_trajectories; trajectory_index++) {
 
-		Eigen::Matrix<Scalar, Eigen::Dynamic, 3> sample_points_xyz_over_time =  trajectory_selector->sampleTrajectoryForDrawing(trajectory_index, sampling_time_vector, num_samples);
-
 		nav_msgs::Path action_samples_msg;
 		action_samples_msg.header.frame_id = drawing_frame;
 		action_samples_msg.header.stamp = ros::Time::now();
 		Vector3 sigma;
 		for (size_t sample = 0; sample < num_samples; sample++) {
-			action_samples_msg.poses.push_back(PoseFromVector3(sample_points_xyz_over_time.row(sample), drawing_frame));
+			action_samples_msg.poses.push_back(PoseFromVector3(sample_points_xyz_over_time.getSample(trajectory_index, sample), drawing_frame));
 			sigma = trajectory_library_ptr->getRDFSigmaAtTime(sampling_time_vector(sample));
 			if (trajectory_index == *best_traj_index) {
-				drawGaussianPropagation(sample, sample_points_xyz_over_time.row(sample), sigma);
+				drawGaussianPropagation(sample, sample_points_xyz_over_time.getSample(trajectory_index, sample), sigma);
 			}
 		}
 
 		// if (trajectory_index == *best_traj_index) {
-		// 	drawFinalStoppingPosition(num_samples-1, sample_points_xyz_over_time.row(num_samples-1));
+		// 	drawFinalStoppingPosition(num_samples-1, sample_points_xyz_over_time.getSample(trajectory_index, num_samples-1));
 		// }
-		drawCollisionIndicator(trajectory_index, sample_points_xyz_over_time.row(num_samples-1), normalized_collision_probabilities(trajectory_index));
+		drawCollisionIndicator(trajectory_index, sample_points_xyz_over_time.getSample(trajectory_index, num_samples-1), normalized_collision_probabilities(trajectory_index));
 
 		action_paths_pubs.at(trajectory_index).publish(action_samples_msg);
 	}
-}
\ No newline at end of file
+}
+
+template class TrajectoryVisualizer<25>;
+template class TrajectoryVisualizer<Eigen::Dynamic>;
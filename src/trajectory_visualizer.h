@@ -10,17 +10,20 @@
 #include "trajectory_selector.h"
 //#include "trajectory_selector_utils.h"
 
+template <int LibrarySize>
 class TrajectoryVisualizer {
 public:
+
+	typedef typename TrajectorySelector<LibrarySize>::LibraryVector LibraryVector;
 	
 	TrajectoryVisualizer() {};
 
-	void initialize(TrajectorySelector* trajectory_selector, ros::NodeHandle & nh, size_t* best_traj_index, double const& final_time) {
+	void initialize(TrajectorySelector<LibrarySize>* trajectory_selector, ros::NodeHandle & nh, size_t* best_traj_index, double const& final_time) {
 		this->trajectory_selector = trajectory_selector;
 		this->nh = nh;
 		this->best_traj_index = best_traj_index;
 		this->final_time = final_time;
-		collision_probabilities.setZero();
+		collision_probabilities.setZero(trajectory_selector->getNumTrajectories());
 
 		gaussian_pub = nh.advertise<visualization_msgs::Marker>( "gaussian_visualization", 0 );
 
@@ -39,7 +42,7 @@ public:
   void drawGaussianPropagation(int id, Vector3 position, Vector3 sigma);
   void drawFinalStoppingPosition(int id, Vector3 position);
   void drawCollisionIndicator(int const& id, Vector3 const& position, double const& collision_prob);
-  void setCollisionProbabilities(Eigen::Matrix<Scalar, 25, 1> const& collision_probabilities) {
+  void setCollisionProbabilities(LibraryVector const& collision_probabilities) {
   	this->collision_probabilities = collision_probabilities;
   }
   void drawDebugPoints();
@@ -55,7 +58,7 @@ private:
 	ros::Publisher gaussian_pub;
 	std::vector<ros::Publisher> action_paths_pubs;
 
-  TrajectorySelector* trajectory_selector;
+  TrajectorySelector<LibrarySize>* trajectory_selector;
 
   Eigen::Matrix<Scalar, Eigen::Dynamic, 1> sampling_time_vector;
   size_t num_samples;
@@ -64,9 +67,11 @@ private:
 
   size_t* best_traj_index;
 
-  Eigen::Matrix<Scalar, 25, 1> collision_probabilities;
-  Eigen::Matrix<Scalar, 25, 1> normalized_collision_probabilities;
+  LibraryVector collision_probabilities;
+  LibraryVector normalized_collision_probabilities;
   
 };
 
+typedef TrajectoryVisualizer<25> TrajectoryVisualizer2D;
+
 #endif
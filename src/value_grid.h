@@ -27,12 +27,12 @@ public:
 		values = data;
 	}
 
-	int GetValueOfPosition(Vector3 const& position_in_world_frame);
+	int GetValueOfPosition(Vector3 const& position_in_world_frame) const;
 
 private:
-	Eigen::Matrix<Scalar, 2, 1> transformIntoValueGridFrame(Vector3 const& point);
-	void IndexInValueGrid(Eigen::Matrix<Scalar, 2, 1> const& position_in_value_grid_frame, size_t& x_index, size_t& y_index);
-	int ValueFromIndex(size_t x_index, size_t y_index);
+	Eigen::Matrix<Scalar, 2, 1> transformIntoValueGridFrame(Vector3 const& point) const;
+	void IndexInValueGrid(Eigen::Matrix<Scalar, 2, 1> const& position_in_value_grid_frame, size_t& x_index, size_t& y_index) const;
+	int ValueFromIndex(size_t x_index, size_t y_index) const;
 
 	float resolution;
 	size_t width;
@@ -0,0 +1,94 @@
+#include "worker_pool.h"
+
+WorkerPool::~WorkerPool() {
+  StopWorkers();
+}
+
+void WorkerPool::setNumWorkers(size_t num_workers) {
+  StopWorkers();
+  stopping = false;
+  // Workers start from the current generation, so a job posted before they first wait is not missed
+  for (size_t i = 0; i < num_workers; i++) {
+    workers.push_back(std::thread(&WorkerPool::WorkerLoop, this, job_generation));
+  }
+}
+
+void WorkerPool::StopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  job_ready.notify_all();
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers.at(i).join();
+  }
+  workers.clear();
+}
+
+void WorkerPool::ParallelFor(size_t num_chunks, std::function<void(size_t)> const& chunk_function) {
+  // Not worth waking anyone for a single chunk
+  if (workers.empty() || num_chunks <= 1) {
+    for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+      chunk_function(chunk);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job_function = &chunk_function;
+    job_num_chunks = num_chunks;
+    next_chunk = 0;
+    job_exception = nullptr;
+    num_busy_workers = workers.size();
+    job_generation++;
+  }
+  job_ready.notify_all();
+
+  RunChunks();
+
+  // Every worker must have left RunChunks before chunk_function goes out of scope
+  std::unique_lock<std::mutex> lock(mutex);
+  job_done.wait(lock, [this] { return num_busy_workers == 0; });
+  job_function = nullptr;
+  if (job_exception) {
+    std::exception_ptr exception = job_exception;
+    job_exception = nullptr;
+    std::rethrow_exception(exception);
+  }
+}
+
+void WorkerPool::RunChunks() {
+  for (size_t chunk = next_chunk++; chunk < job_num_chunks; chunk = next_chunk++) {
+    try {
+      (*job_function)(chunk);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!job_exception) {
+        job_exception = std::current_exception();
+      }
+      next_chunk = job_num_chunks;
+    }
+  }
+}
+
+void WorkerPool::WorkerLoop(size_t last_generation) {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      job_ready.wait(lock, [this, last_generation] { return stopping || job_generation != last_generation; });
+      if (stopping) {
+        return;
+      }
+      last_generation = job_generation;
+    }
+
+    RunChunks();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      num_busy_workers--;
+    }
+    job_done.notify_one();
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent threads that share the chunks of one ParallelFor at a time.
+// Idle threads, including the caller, claim the next unclaimed chunk, so uneven chunks balance themselves.
+// Chunks must write disjoint outputs; any reduction over them is left to the caller, in a fixed order.
+class WorkerPool {
+public:
+
+  WorkerPool() {};
+  ~WorkerPool();
+  WorkerPool(WorkerPool const&) = delete;
+  WorkerPool& operator=(WorkerPool const&) = delete;
+
+  // 0 workers runs every ParallelFor inline on the calling thread
+  void setNumWorkers(size_t num_workers);
+  size_t getNumWorkers() const {
+    return workers.size();
+  };
+
+  // Calls chunk_function(chunk) once for every chunk in [0, num_chunks) and returns when all have finished.
+  // If a chunk throws, unclaimed chunks are skipped and the first exception is rethrown here once every thread is done.
+  void ParallelFor(size_t num_chunks, std::function<void(size_t)> const& chunk_function);
+
+private:
+
+  void WorkerLoop(size_t last_generation);
+  void RunChunks();
+  void StopWorkers();
+
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable job_ready;
+  std::condition_variable job_done;
+  size_t job_generation = 0;
+  size_t num_busy_workers = 0;
+  bool stopping = false;
+
+  std::function<void(size_t)> const* job_function = nullptr;
+  size_t job_num_chunks = 0;
+  std::atomic<size_t> next_chunk{0};
+  std::exception_ptr job_exception;
+
+};
+
+#endif